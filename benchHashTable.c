@@ -0,0 +1,539 @@
+/* Benchmark of the hash table operations, printed as JSON so results can be
+ * compared between releases.
+ *
+ * Every run builds a table of n uint64_t keys with one engine, key
+ * distribution and rehash load factor, then times:
+ *
+ *    addMiss: htAdd of the n keys (each one new), rehashes included.
+ *    addHit: htAdd of keys already present.
+ *    lookUpHit, lookUpMiss: htLookUp of present and absent keys.
+ *    toArray, destroy: One htToArray and the htDestroy, per entry.
+ *
+ * The per operation phases report ns/op over all operations and the 50th,
+ * 99th and 99.9th percentile latency of a sample of individually timed
+ * operations (timer overhead subtracted). Every rehash is timed on its own
+ * and listed separately.
+ *
+ * Distributions:
+ *
+ *    uniform: Random keys, accessed uniformly.
+ *    zipf: Random keys, accessed with Zipf's law (s = 0.99), the most
+ *       frequent key about n^0.99 times as often as the least.
+ *    sequential: The keys 0 to n - 1, inserted in order.
+ *    adversarial: Random keys whose hashes all reduce (with the default
+ *       HT_INDEX_MODULO) into the first 1/64 of the final table's buckets,
+ *       as a hash flooding attacker knowing FNHash would choose them.
+ *
+ *    gcc -O2 -ansi -pedantic -Wall -pthread -o benchHashTable \
+ *       benchHashTable.c hashTable*.c htHashes.c -lm
+ *    ./benchHashTable [-n maxKeys] [-e engines] [-d distributions]
+ *       [-l loadFactors] [-s seed] > results.json
+ *
+ * Key counts are the powers of ten from 1000 up to maxKeys (default 1e6),
+ * the lists are comma separated. Each key costs about 100 bytes, so 1e8
+ * keys need about 10 GB.
+ */
+#define _POSIX_C_SOURCE 199309L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include "hashTableEx.h"
+#include "htHashes.h"
+
+#define MIN_OPS 1000000UL
+#define MAX_STREAM (1UL << 22)
+#define MAX_SAMPLES 100000UL
+#define MAX_REHASHES 64
+#define ZIPF_S 0.99
+#define ADVERSARIAL_SHARE 64
+#define MISS_BIT ((uint64_t)1 << 63)
+
+typedef enum {ADD_MISS, ADD_HIT, LOOKUP_HIT, LOOKUP_MISS} OpKind;
+
+typedef struct
+{
+   unsigned long ops;
+   double nsPerOp;
+   double p50, p99, p999;
+} PhaseResult;
+
+typedef struct
+{
+   unsigned from, to;
+   double ns;
+} Rehash;
+
+typedef struct
+{
+   const char *engineName, *distribution;
+   HTEngineType engine;
+   unsigned long keys;
+   float loadFactor;
+   unsigned capacity;
+   PhaseResult phases[4];
+   double toArrayNs, destroyNs;
+   Rehash rehashes[MAX_REHASHES];
+   unsigned numRehashes;
+} Run;
+
+typedef struct
+{
+   uint64_t state;
+   double zetaN, zeta2, eta, alpha;
+   unsigned long n;
+} Random;
+
+static unsigned sizes[] = {53, 97, 193, 389, 769, 1543, 3079, 6151, 12289,
+   24593, 49157, 98317, 196613, 393241, 786433, 1572869, 3145739, 6291469,
+   12582917, 25165843, 50331653, 100663319, 201326611, 402653189,
+   805306457, 1610612741};
+#define NUM_SIZES (int)(sizeof(sizes) / sizeof(sizes[0]))
+
+static const char *engineNames[] = {"chain", "robinhood", "swiss",
+   "concurrent"};
+static volatile unsigned sink;
+static double timerOverhead;
+
+static int compareUint64(const void *a, const void *b)
+{
+   uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+
+   return (x > y) - (x < y);
+}
+
+static HTFunctions funcs = {htHashUint64, compareUint64, NULL};
+
+static double now(void)
+{
+   struct timespec ts;
+
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* The cheapest of many back to back reads of the clock. */
+static void calibrate(void)
+{
+   int i;
+   double t, least = 1e9;
+
+   for (i = 0; i < 10000; i++)
+   {
+      t = now();
+      t = now() - t;
+      if (t < least)
+         least = t;
+   }
+   timerOverhead = least;
+}
+
+static void* allocOrDie(size_t size)
+{
+   void *p = malloc(size);
+
+   if (p == NULL)
+   {
+      fprintf(stderr, "benchHashTable: out of memory\n");
+      exit(EXIT_FAILURE);
+   }
+   return p;
+}
+
+/* splitmix64 */
+static uint64_t next64(Random *r)
+{
+   uint64_t z = (r->state += UINT64_C(0x9E3779B97F4A7C15));
+
+   z = (z ^ (z >> 30)) * UINT64_C(0xBF58476D1CE4E5B9);
+   z = (z ^ (z >> 27)) * UINT64_C(0x94D049BB133111EB);
+   return z ^ (z >> 31);
+}
+
+static double nextDouble(Random *r)
+{
+   return (next64(r) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/* Gray et al., "Quickly generating billion-record synthetic databases":
+ * O(n) setup, then O(1) per rank.
+ */
+static void initZipf(Random *r, unsigned long n)
+{
+   unsigned long i;
+
+   r->n = n;
+   r->zetaN = 0;
+   for (i = 1; i <= n; i++)
+      r->zetaN += pow((double)i, -ZIPF_S);
+   r->zeta2 = 1 + pow(0.5, ZIPF_S);
+   r->alpha = 1 / (1 - ZIPF_S);
+   r->eta = (1 - pow(2.0 / n, 1 - ZIPF_S)) / (1 - r->zeta2 / r->zetaN);
+}
+
+static unsigned long nextZipf(Random *r)
+{
+   double u = nextDouble(r), uz = u * r->zetaN;
+   unsigned long rank;
+
+   if (uz < 1)
+      return 0;
+   if (uz < r->zeta2)
+      return 1;
+   rank = (unsigned long)(r->n * pow(r->eta * u - r->eta + 1, r->alpha));
+   return rank < r->n ? rank : r->n - 1;
+}
+
+/* The capacity the table ends up with after n adds: htAdd grows the table
+ * whenever the entries already in it exceed the load factor.
+ */
+static unsigned finalCapacity(unsigned long n, float loadFactor)
+{
+   int i;
+
+   for (i = 0; i < NUM_SIZES - 1; i++)
+      if ((float)(n - 1) / sizes[i] <= loadFactor)
+         break;
+   return sizes[i];
+}
+
+static uint64_t adversarialKey(Random *r, unsigned capacity,
+   uint64_t missBit)
+{
+   uint64_t key;
+
+   do
+      key = (next64(r) & ~MISS_BIT) | missBit;
+   while (htHashUint64(&key) % capacity >= capacity / ADVERSARIAL_SHARE + 1);
+   return key;
+}
+
+/* Present keys never have MISS_BIT set, absent ones always do. */
+static void makeKeys(const char *distribution, Random *r, uint64_t *keys,
+   unsigned long n, unsigned capacity, uint64_t missBit)
+{
+   unsigned long i;
+
+   for (i = 0; i < n; i++)
+   {
+      if (!strcmp(distribution, "sequential"))
+         keys[i] = missBit ? n + i : i;
+      else if (!strcmp(distribution, "adversarial"))
+         keys[i] = adversarialKey(r, capacity, missBit);
+      else
+         keys[i] = (next64(r) & ~MISS_BIT) | missBit;
+   }
+}
+
+/* The keys the hit phases access, MAX_STREAM at most and reused cyclically.
+ */
+static void** hitStream(const char *distribution, Random *r, uint64_t *keys,
+   unsigned long n, unsigned long length)
+{
+   void **stream = allocOrDie(length * sizeof(void*));
+   unsigned long i, rank;
+   uint64_t scrambled;
+
+   if (!strcmp(distribution, "zipf"))
+      initZipf(r, n);
+   for (i = 0; i < length; i++)
+   {
+      if (!strcmp(distribution, "zipf"))
+      {
+         /* Scatter the ranks so the hot keys are not the first inserted */
+         scrambled = rank = nextZipf(r);
+         rank = htHashUint64(&scrambled) % n;
+      }
+      else
+         rank = next64(r) % n;
+      stream[i] = &keys[rank];
+   }
+   return stream;
+}
+
+static int compareDouble(const void *a, const void *b)
+{
+   double x = *(const double*)a, y = *(const double*)b;
+
+   return (x > y) - (x < y);
+}
+
+static double percentile(double *samples, unsigned long count, double q)
+{
+   return count ? samples[(unsigned long)(q * (count - 1))] : 0;
+}
+
+static void op(OpKind kind, void *ht, void *key)
+{
+   if (kind == ADD_MISS || kind == ADD_HIT)
+      sink += htAdd(ht, key);
+   else
+      sink += htLookUp(ht, key).frequency;
+}
+
+static void recordRehash(Run *run, unsigned from, unsigned to, double ns)
+{
+   if (run->numRehashes == MAX_REHASHES)
+      return;
+   run->rehashes[run->numRehashes].from = from;
+   run->rehashes[run->numRehashes].to = to;
+   run->rehashes[run->numRehashes++].ns = ns;
+}
+
+/* Times an add that may rehash on its own. Returns the entry count from
+ * which the next rehash may happen: most engines grow before an add that
+ * finds the load factor exceeded, the concurrent engine right after the add
+ * that exceeds it.
+ */
+static double timeRehash(Run *run, void *ht, void *key)
+{
+   unsigned capacity = htCapacity(ht);
+   double t = now();
+
+   op(ADD_MISS, ht, key);
+   t = now() - t - timerOverhead;
+   if (htCapacity(ht) != capacity)
+      recordRehash(run, capacity, htCapacity(ht), t);
+   return run->loadFactor * htCapacity(ht) - 1;
+}
+
+/* Times ops operations on stream[i % length]. Every stride-th one is also
+ * timed on its own for the percentiles. In the ADD_MISS phase, where every
+ * key is new so i is the number of entries, the adds that may rehash are
+ * timed separately.
+ */
+static void runPhase(Run *run, OpKind kind, void *ht, void **stream,
+   unsigned long length, unsigned long ops)
+{
+   PhaseResult *result = &run->phases[kind];
+   unsigned long i, count = 0, stride = (ops + MAX_SAMPLES - 1) / MAX_SAMPLES;
+   double *samples = allocOrDie((ops / stride + 1) * sizeof(double));
+   double rehashAt = kind == ADD_MISS ?
+      run->loadFactor * htCapacity(ht) - 1 : HUGE_VAL;
+   double start = now(), t;
+
+   for (i = 0; i < ops; i++)
+   {
+      if (i >= rehashAt)
+         rehashAt = timeRehash(run, ht, stream[i % length]);
+      else if (i % stride == 0)
+      {
+         t = now();
+         op(kind, ht, stream[i % length]);
+         t = now() - t - timerOverhead;
+         samples[count++] = t < 0 ? 0 : t;
+      }
+      else
+         op(kind, ht, stream[i % length]);
+   }
+   result->ops = ops;
+   result->nsPerOp = (now() - start) / ops;
+   qsort(samples, count, sizeof(double), compareDouble);
+   result->p50 = percentile(samples, count, 0.5);
+   result->p99 = percentile(samples, count, 0.99);
+   result->p999 = percentile(samples, count, 0.999);
+   free(samples);
+}
+
+static void* createTable(Run *run)
+{
+   HTOptions options;
+
+   htDefaultOptions(&options);
+   options.engine = run->engine;
+   return htCreateEx(&funcs, sizes, NUM_SIZES, run->loadFactor, &options);
+}
+
+static void benchRun(Run *run, Random *r)
+{
+   unsigned long i, n = run->keys, ops = n < MIN_OPS ? MIN_OPS : n;
+   unsigned long length = ops < MAX_STREAM ? ops : MAX_STREAM;
+   unsigned capacity = finalCapacity(n, run->loadFactor);
+   uint64_t *keys = allocOrDie(n * sizeof(uint64_t));
+   uint64_t *misses = allocOrDie(length * sizeof(uint64_t));
+   void **owned = allocOrDie(n * sizeof(void*)), **stream, *ht;
+   unsigned size;
+   double t;
+
+   makeKeys(run->distribution, r, keys, n, capacity, 0);
+   makeKeys(run->distribution, r, misses, length, capacity, MISS_BIT);
+   for (i = 0; i < n; i++)
+   {
+      owned[i] = allocOrDie(sizeof(uint64_t));
+      *(uint64_t*)owned[i] = keys[i];
+   }
+
+   ht = createTable(run);
+   run->numRehashes = 0;
+   runPhase(run, ADD_MISS, ht, owned, n, n);
+   run->capacity = htCapacity(ht);
+
+   stream = hitStream(run->distribution, r, keys, n, length);
+   runPhase(run, ADD_HIT, ht, stream, length, ops);
+   runPhase(run, LOOKUP_HIT, ht, stream, length, ops);
+   for (i = 0; i < length; i++)
+      stream[i] = &misses[i];
+   runPhase(run, LOOKUP_MISS, ht, stream, length, ops);
+
+   t = now();
+   free(htToArray(ht, &size));
+   run->toArrayNs = (now() - t) / n;
+   t = now();
+   htDestroy(ht);
+   run->destroyNs = (now() - t) / n;
+
+   free(stream);
+   free(owned);
+   free(misses);
+   free(keys);
+}
+
+static void printPhase(const char *name, PhaseResult *p, int last)
+{
+   printf("        \"%s\": {\"ops\": %lu, \"nsPerOp\": %.2f, \"p50\": %.0f, "
+      "\"p99\": %.0f, \"p999\": %.0f}%s\n", name, p->ops, p->nsPerOp, p->p50,
+      p->p99, p->p999, last ? "" : ",");
+}
+
+static void printRun(Run *run, int first)
+{
+   unsigned i;
+
+   printf("%s    {\n", first ? "" : ",\n");
+   printf("      \"engine\": \"%s\", \"distribution\": \"%s\", "
+      "\"keys\": %lu, \"loadFactor\": %.2f, \"capacity\": %u,\n",
+      run->engineName, run->distribution, run->keys, run->loadFactor,
+      run->capacity);
+   printf("      \"phases\": {\n");
+   printPhase("addMiss", &run->phases[ADD_MISS], 0);
+   printPhase("addHit", &run->phases[ADD_HIT], 0);
+   printPhase("lookUpHit", &run->phases[LOOKUP_HIT], 0);
+   printPhase("lookUpMiss", &run->phases[LOOKUP_MISS], 0);
+   printf("        \"toArray\": {\"nsPerEntry\": %.2f},\n", run->toArrayNs);
+   printf("        \"destroy\": {\"nsPerEntry\": %.2f}\n", run->destroyNs);
+   printf("      },\n      \"rehashes\": [");
+   for (i = 0; i < run->numRehashes; i++)
+      printf("%s{\"from\": %u, \"to\": %u, \"ns\": %.0f}", i ? ", " : "",
+         run->rehashes[i].from, run->rehashes[i].to, run->rehashes[i].ns);
+   printf("]\n    }");
+   fflush(stdout);
+}
+
+static void usage(void)
+{
+   fprintf(stderr, "usage: benchHashTable [-n maxKeys] [-e engines] "
+      "[-d distributions] [-l loadFactors] [-s seed]\n"
+      "   engines: chain,robinhood,swiss,concurrent (default chain)\n"
+      "   distributions: uniform,zipf,sequential,adversarial (default all)\n"
+      "   loadFactors: default 0.5,0.73,0.9\n");
+   exit(EXIT_FAILURE);
+}
+
+static int engineIndex(const char *name)
+{
+   int i;
+
+   for (i = 0; i < 4; i++)
+      if (!strcmp(name, engineNames[i]))
+         return i;
+   usage();
+   return 0;
+}
+
+static int checkDistribution(const char *name)
+{
+   return !strcmp(name, "uniform") || !strcmp(name, "zipf") ||
+      !strcmp(name, "sequential") || !strcmp(name, "adversarial");
+}
+
+/* Splits a comma separated list in place, returning the number of items. */
+static int splitList(char *list, char *items[], int max)
+{
+   int count = 0;
+   char *item;
+
+   for (item = strtok(list, ","); item; item = strtok(NULL, ","))
+   {
+      if (count == max)
+         usage();
+      items[count++] = item;
+   }
+   return count;
+}
+
+static void benchAll(unsigned long maxKeys, char *engines[], int numEngines,
+   char *dists[], int numDists, float loadFactors[], int numLoadFactors,
+   Random *r)
+{
+   int e, d, l, first = 1;
+   unsigned long n;
+   Run run;
+
+   printf("{\n  \"timerOverheadNs\": %.0f,\n  \"runs\": [\n", timerOverhead);
+   for (e = 0; e < numEngines; e++)
+      for (n = 1000; n <= maxKeys; n *= 10)
+         for (d = 0; d < numDists; d++)
+            for (l = 0; l < numLoadFactors; l++)
+            {
+               run.engine = (HTEngineType)engineIndex(engines[e]);
+               run.engineName = engineNames[run.engine];
+               run.distribution = dists[d];
+               run.keys = n;
+               run.loadFactor = loadFactors[l];
+               benchRun(&run, r);
+               printRun(&run, first);
+               first = 0;
+            }
+   printf("\n  ]\n}\n");
+}
+
+int main(int argc, char *argv[])
+{
+   char defaultEngines[] = "chain";
+   char defaultDists[] = "uniform,zipf,sequential,adversarial";
+   char defaultLoads[] = "0.5,0.73,0.9";
+   char *engineList = defaultEngines, *distList = defaultDists;
+   char *loadList = defaultLoads, *engines[4], *dists[4], *loads[16];
+   int i, numEngines, numDists, numLoads;
+   float loadFactors[16];
+   unsigned long maxKeys = 1000000;
+   Random r;
+
+   r.state = 1;
+   for (i = 1; i + 1 < argc && argv[i][0] == '-'; i += 2)
+   {
+      if (!strcmp(argv[i], "-n"))
+         maxKeys = (unsigned long)atof(argv[i + 1]);
+      else if (!strcmp(argv[i], "-e"))
+         engineList = argv[i + 1];
+      else if (!strcmp(argv[i], "-d"))
+         distList = argv[i + 1];
+      else if (!strcmp(argv[i], "-l"))
+         loadList = argv[i + 1];
+      else if (!strcmp(argv[i], "-s"))
+         r.state = strtoul(argv[i + 1], NULL, 10);
+      else
+         usage();
+   }
+   if (i != argc)
+      usage();
+
+   numEngines = splitList(engineList, engines, 4);
+   numDists = splitList(distList, dists, 4);
+   numLoads = splitList(loadList, loads, 16);
+   for (i = 0; i < numEngines; i++)
+      engineIndex(engines[i]);
+   for (i = 0; i < numDists; i++)
+      if (!checkDistribution(dists[i]))
+         usage();
+   for (i = 0; i < numLoads; i++)
+      if ((loadFactors[i] = (float)atof(loads[i])) <= 0 ||
+         loadFactors[i] > 1)
+         usage();
+
+   calibrate();
+   benchAll(maxKeys, engines, numEngines, dists, numDists, loadFactors,
+      numLoads, &r);
+   return 0;
+}
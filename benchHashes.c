@@ -0,0 +1,130 @@
+/* Throughput of the htHashes.h functions against the K&R string hash used by
+ * testHashTable.c, plus how evenly each spreads sequential keys ("k0",
+ * "k1", ... or 0, 1, ...) over a power of two number of buckets.
+ *
+ *    gcc -O2 -ansi -pedantic -Wall -o benchHashes benchHashes.c htHashes.c
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "htHashes.h"
+
+#define BYTES_PER_RUN 200000000.0
+#define BUCKETS 65536
+#define SPREAD_KEYS 500000
+#define KEYS 16
+
+volatile unsigned sink;
+
+unsigned hashKR(const void *data)
+{
+   unsigned hash;
+   const char *str = data;
+
+   for (hash = 0; *str; str++)
+      hash = *str + 31 * hash;
+   return hash;
+}
+
+/* What a plain cast of a 64 bit key to FNHash's unsigned does. */
+unsigned hashTruncate(const void *data)
+{
+   return (unsigned)*(const uint64_t*)data;
+}
+
+double seconds(clock_t start)
+{
+   return (double)(clock() - start) / CLOCKS_PER_SEC;
+}
+
+/* Hashes NUL terminated keys of len bytes, taking turns among KEYS copies
+ * that differ in their first byte. The hashes are independent, so this
+ * measures throughput rather than the latency of one hash.
+ */
+void benchString(const char *name, FNHash hash, size_t len)
+{
+   unsigned long i, runs = (unsigned long)(BYTES_PER_RUN / (len + 8));
+   unsigned h = 0;
+   char *keys[KEYS];
+   clock_t start;
+   double secs;
+
+   for (i = 0; i < KEYS; i++)
+   {
+      keys[i] = malloc(len + 1);
+      memset(keys[i], 'a' + (int)(len % 26), len);
+      keys[i][0] = (char)('a' + i);
+      keys[i][len] = '\0';
+   }
+   start = clock();
+   for (i = 0; i < runs; i++)
+      h ^= hash(keys[i % KEYS]);
+   secs = seconds(start);
+   sink = h;
+   printf("%-14s %6lu %10.0f MB/s %8.2f ns/hash\n", name, (unsigned long)len,
+      runs * (double)len / secs / 1e6, secs * 1e9 / runs);
+   for (i = 0; i < KEYS; i++)
+      free(keys[i]);
+}
+
+void benchInt(const char *name, FNHash hash, int wide)
+{
+   unsigned long i, runs = 100000000;
+   unsigned narrow = 0, h = 0;
+   uint64_t big = 0;
+   clock_t start = clock();
+   double secs;
+
+   for (i = 0; i < runs; i++)
+   {
+      h ^= wide ? hash(&big) : hash(&narrow);
+      big += UINT64_C(0x9E3779B97F4A7C15);
+      narrow += 0x9E3779B9u;
+   }
+   secs = seconds(start);
+   sink = h;
+   printf("%-14s %6s %10.0f M/s  %8.2f ns/hash\n", name, wide ? "8" : "4",
+      runs / secs / 1e6, secs * 1e9 / runs);
+}
+
+/* The largest bucket; the average is SPREAD_KEYS / BUCKETS, about 8. */
+void spread(const char *name, FNHash hash, int keyType)
+{
+   unsigned *buckets = calloc(BUCKETS, sizeof(unsigned)), i, max = 0, h;
+   uint64_t wide;
+   char key[16];
+
+   for (i = 0; i < SPREAD_KEYS; i++)
+   {
+      sprintf(key, "k%u", i);
+      wide = (uint64_t)i << 32;
+      h = keyType == 0 ? hash(key) : keyType == 1 ? hash(&i) : hash(&wide);
+      if (++buckets[h % BUCKETS] > max)
+         max = buckets[h % BUCKETS];
+   }
+   printf("%-14s largest of %d buckets: %u\n", name, BUCKETS, max);
+   free(buckets);
+}
+
+int main(void)
+{
+   size_t lengths[] = {4, 8, 16, 32, 64, 256, 1024, 4096}, i;
+
+   printf("hash            bytes    throughput\n");
+   for (i = 0; i < sizeof(lengths) / sizeof(lengths[0]); i++)
+   {
+      benchString("K&R", hashKR, lengths[i]);
+      benchString("htHashString", htHashString, lengths[i]);
+   }
+   benchInt("htHashUnsigned", htHashUnsigned, 0);
+   benchInt("htHashUint64", htHashUint64, 1);
+
+   printf("\nsequential keys\n");
+   spread("K&R", hashKR, 0);
+   spread("htHashString", htHashString, 0);
+   spread("htHashUnsigned", htHashUnsigned, 1);
+   spread("truncate64", hashTruncate, 2);
+   spread("htHashUint64", htHashUint64, 2);
+   return 0;
+}
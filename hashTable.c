@@ -1,76 +1,201 @@
 #include <limits.h>
 #include "hashTable.h"
+#include "hashTablePriv.h"
 #include <assert.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <stdint.h>
+#include <string.h>
 
-typedef struct node
+void mallocError()
 {
-   HTEntry *entry;
-   struct node *next;
-} HashNode;
+   fprintf(stderr, "malloc failure in %s at %d\n",__FILE__, __LINE__);
+   exit(EXIT_FAILURE);
+}
 
-typedef struct
+void initPool(NodePool *pool, size_t nodeSize)
 {
-   HTFunctions *functions;
-   unsigned *sizes, sizeIndex;
-   unsigned totalEntries, uniqueEntries;
-   int numSizes;
-   float rehashLoadFactor;
-   HashNode **arr;
-   
-} HashTable;
+   pool->slabs = NULL;
+   pool->freeList = NULL;
+   pool->nextSlabCount = MIN_SLAB_NODES;
+   pool->numSlabs = 0;
+   pool->nodeSize = nodeSize;
+   pool->bytes = 0;
+}
 
-void mallocError()
+void addSlab(NodePool *pool)
 {
-   fprintf(stderr, "malloc failure in %s at %d\n",__FILE__, __LINE__);
-   exit(EXIT_FAILURE);
+   size_t bytes = sizeof(NodeSlab) - sizeof(HashNode) +
+      pool->nextSlabCount * pool->nodeSize;
+   NodeSlab *slab = malloc(bytes);
+   if(slab == NULL)
+      mallocError();
+   pool->bytes += bytes;
+   pool->numSlabs++;
+   slab->used = 0;
+   slab->count = pool->nextSlabCount;
+   slab->next = pool->slabs;
+   pool->slabs = slab;
+   if(pool->nextSlabCount < MAX_SLAB_NODES)
+      pool->nextSlabCount *= 2;
 }
 
-void freeNode(HashNode *node, FNDestroy destroy)
+HashNode* slabNode(NodeSlab *slab, size_t nodeSize, unsigned i)
 {
-   if(destroy != NULL)
-      destroy(node->entry->data);
-   free(node->entry->data);
-   free(node->entry);
-   free(node);
+   return (HashNode*)((char*)slab->nodes + i * nodeSize);
 }
 
-void traverseLinksDes(HashNode* hashNodeP, FNDestroy destroy)
+HashNode* allocNode(NodePool *pool)
 {
-   HashNode *hashNodeQ;
+   HashNode *node;
 
-   while((hashNodeP)!= NULL)
+   if(pool->freeList)
    {
-      hashNodeQ = hashNodeP->next;
-      freeNode(hashNodeP, destroy);
-      hashNodeP = hashNodeQ;
+      node = pool->freeList;
+      pool->freeList = node->next;
+      return node;
    }
-}   
+   if(pool->slabs == NULL || pool->slabs->used == pool->slabs->count)
+      addSlab(pool);
+   return slabNode(pool->slabs, pool->nodeSize, pool->slabs->used++);
+}
 
-void checkRoot(HashNode* htRootNode, FNDestroy destroy, int i)
+/* Returns a node that was never linked into a chain to the pool. Its data
+ * stays with the caller, so it is cleared for the slab walk of destroyPool.
+ */
+void releaseNode(NodePool *pool, HashNode *node)
 {
-   HashNode *hashNodeP;
+   node->entry.data = NULL;
+   node->next = pool->freeList;
+   pool->freeList = node;
+}
 
-   if (htRootNode != NULL)
-   { 
-      hashNodeP = htRootNode;
-      traverseLinksDes(hashNodeP, destroy);
-   }   
-}   
+/* The room for an inline key, right after the node. */
+char* inlineKey(HashNode *node)
+{
+   return (char*)(node + 1);
+}
 
-void destroyArr(HashNode **arr, unsigned size, FNDestroy destroy)
+/* Passes stored data to FNDestroy and frees it, unless it belongs to the
+ * table's string arena.
+ */
+void freeData(HashTable *ht, void *data)
 {
-   int i;
-   for(i = 0; i < size; i++)
-      checkRoot(arr[i], destroy, i);
-   free(arr);
+   if(arenaOwnsData(ht))
+      return;
+   if(ht->functions->destroy != NULL)
+      ht->functions->destroy(data);
+   free(data);
+}
+
+/* Inline keys go with their node, spilled keys are freed like any data. */
+void freeNode(HashTable *ht, HashNode *node)
+{
+   if(node->entry.data == NULL || node->entry.data == inlineKey(node))
+      return;
+   freeData(ht, node->entry.data);
+}
+
+/* The bytes of a key or data item the table owns, for htMemoryUsage. Keys
+ * the table copies itself are counted as keyBytes instead.
+ */
+size_t ownedDataSize(HashTable *ht, void *data)
+{
+   if(ht->dataSize == NULL || ht->inlineKeyBytes || arenaOwnsData(ht))
+      return 0;
+   return ht->dataSize(data);
+}
+
+/* Takes what a node about to be discarded owns out of the memory counts. */
+void forgetNode(HashTable *ht, HashNode *node)
+{
+   if(node->entry.data == inlineKey(node))
+      return;
+   if(ht->inlineKeyBytes)
+   {
+      ht->keyBytes -= strlen(node->entry.data) + 1;
+      ht->keyAllocs--;
+   }
+   else
+      ht->dataBytes -= ownedDataSize(ht, node->entry.data);
+}
+
+/* Frees the data of a node folded away by a merge and recycles the node. */
+void dropNode(HashTable *ht, HashNode *node)
+{
+   forgetNode(ht, node);
+   freeNode(ht, node);
+   releaseNode(&ht->pool, node);
+}
+
+void freeSlab(NodeSlab *slab, size_t nodeSize, HashTable *ht)
+{
+   unsigned i;
+
+   for(i = 0; i < slab->used; i++)
+      freeNode(ht, slabNode(slab, nodeSize, i));
+   free(slab);
+}
+
+void destroyPool(NodePool *pool, HashTable *ht)
+{
+   NodeSlab *slab, *nextSlab;
+
+   for(slab = pool->slabs; slab != NULL; slab = nextSlab)
+   {
+      nextSlab = slab->next;
+      freeSlab(slab, pool->nodeSize, ht);
+   }
+   initPool(pool, pool->nodeSize);
 }
 
-unsigned getHash(void *hashTable, void *data)
+unsigned hashData(void *hashTable, void *data)
 {
-   return ((HashTable*)hashTable)->functions->hash(data) 
-      % htCapacity(hashTable);
+   return ((HashTable*)hashTable)->functions->hash(data);
+}
+
+#define FIBONACCI_MULTIPLIER 2654435769u
+#define BATCH_BLOCK 32
+
+/* Lemire's fastmod: the fractional part of hash / size is kept in the low
+ * 64 bits of hash * reciprocal and multiplying it back by the size yields
+ * the remainder in the high 32 bits. The 64 by 32 bit product is formed from
+ * two 32 by 32 bit products so no 128 bit type is needed.
+ */
+unsigned reciprocalMod(unsigned hash, uint64_t reciprocal, unsigned size)
+{
+   uint64_t fraction = reciprocal * hash;
+
+   return (unsigned)(((fraction >> 32) * size +
+      (((fraction & 0xFFFFFFFFu) * size) >> 32)) >> 32);
+}
+
+unsigned fibonacciIndex(unsigned hash, unsigned shift)
+{
+   if(shift == 32)
+      return 0;
+   return (unsigned)((hash * FIBONACCI_MULTIPLIER) & 0xFFFFFFFFu) >> shift;
+}
+
+unsigned reduceHash(HashTable *ht, unsigned hash, unsigned sizeIndex)
+{
+   switch(ht->indexMode)
+   {
+      case HT_INDEX_RECIPROCAL:
+         return reciprocalMod(hash, ht->reciprocals[sizeIndex],
+            ht->sizes[sizeIndex]);
+      case HT_INDEX_MULTIPLY_SHIFT:
+         return (unsigned)(((uint64_t)hash * ht->sizes[sizeIndex]) >> 32);
+      case HT_INDEX_FIBONACCI:
+         return fibonacciIndex(hash, ht->shifts[sizeIndex]);
+      default:
+         return hash % ht->sizes[sizeIndex];
+   }
+}
+
+unsigned getIndex(void *hashTable, unsigned hash)
+{
+   return reduceHash(hashTable, hash, ((HashTable*)hashTable)->sizeIndex);
 }
 
 void traverseLinks(HashNode *listNode, HashNode *newArrNode)
@@ -85,7 +210,7 @@ void traverseLinks(HashNode *listNode, HashNode *newArrNode)
 void moveNode(void* hashTable, HashNode *listNode, HashNode **newArr)
 {
    
-   unsigned hash = getHash(hashTable,((HashNode*)listNode)->entry->data);
+   unsigned hash = getIndex(hashTable, listNode->hash);
    if (newArr[hash])
       traverseLinks(listNode, newArr[hash]);
    else   
@@ -114,44 +239,121 @@ void checkIndex(void* hashTable, HashNode* node, HashNode **newArr, int i)
       checkNodes(hashTable, node, newArr);
 }
 
-void rePopulate(void* hashTable, HashNode **newArr)
+void rePopulate(void* hashTable, HashNode **newArr, unsigned oldSize)
 {
    int i;
 
-   for(i = 0; i < ((HashTable*)hashTable)->sizes[
-      ((HashTable*)hashTable)->sizeIndex - 1]; i++)
+   for(i = 0; i < oldSize; i++)
    {
       checkIndex(hashTable,((HashTable*)hashTable)->arr[i],newArr,i);
    }   
 }   
-void rehash(void *hashTable, void *data)
+void migrateBucket(HashTable *ht, unsigned i)
+{
+   checkIndex(ht, ht->oldArr[i], ht->arr, i);
+   ht->oldArr[i] = NULL;
+}
+
+void endMigration(HashTable *ht)
+{
+   free(ht->oldArr);
+   ht->oldArr = NULL;
+}
+
+/* Moves up to count of the old buckets, finishing the migration when the
+ * last one has been moved.
+ */
+void migrateBuckets(HashTable *ht, unsigned count)
+{
+   for(; count && ht->migrateIndex < ht->oldSize; count--)
+      migrateBucket(ht, ht->migrateIndex++);
+   if(ht->migrateIndex == ht->oldSize)
+      endMigration(ht);
+}
+
+void finishMigration(HashTable *ht)
+{
+   if(ht->oldArr)
+      migrateBuckets(ht, ht->oldSize);
+}
+
+/* Called by every operation on the chaining engine. The old bucket the hash
+ * maps to is migrated first so the operation only has to look at arr.
+ */
+void stepMigration(HashTable *ht, unsigned hash)
+{
+   if(ht->oldArr == NULL)
+      return;
+   migrateBucket(ht, reduceHash(ht, hash, ht->oldSizeIndex));
+   migrateBuckets(ht, ht->incrementalRehash);
+}
+
+void startMigration(HashTable *ht, HashNode **newArr, unsigned oldSizeIndex)
+{
+   ht->oldArr = ht->arr;
+   ht->oldSizeIndex = oldSizeIndex;
+   ht->oldSize = ht->sizes[oldSizeIndex];
+   ht->migrateIndex = 0;
+   ht->arr = newArr;
+}
+
+void chainResize(HashTable *ht, unsigned sizeIndex)
 {
    HashNode **newArr;
-   (((HashTable*)hashTable)->sizeIndex)++; 
-   newArr = calloc(
-      ((HashTable*)hashTable)->sizes[((HashTable*)hashTable)->sizeIndex], 
-      sizeof(HashNode*));
+   unsigned oldSizeIndex;
+
+   finishMigration(ht);
+   oldSizeIndex = ht->sizeIndex;
+   ht->sizeIndex = sizeIndex;
+   newArr = calloc(ht->sizes[sizeIndex], sizeof(HashNode*));
    if(newArr  == NULL)
       mallocError();
-   rePopulate(hashTable, newArr);   
-   free(((HashTable*)hashTable)->arr);
+   if(ht->incrementalRehash)
+   {
+      startMigration(ht, newArr, oldSizeIndex);
+      return;
+   }
+   if(ht->rehashThreads > 1)
+      partitionedRehash(ht, ht->arr, ht->sizes[oldSizeIndex], newArr);
+   else
+      rePopulate(ht, newArr, ht->sizes[oldSizeIndex]);
+   free(ht->arr);
    
-   ((HashTable*)hashTable)->arr = newArr;
+   ht->arr = newArr;
 }   
+
+void rehash(void *hashTable, void *data)
+{
+   chainResize(hashTable, ((HashTable*)hashTable)->sizeIndex + 1);
+}
 float calcLf(void *hashTable)
 {
    return ((float)htUniqueEntries(hashTable)) /
       ((float)(((HashTable*)hashTable)->
       sizes[((HashTable*)hashTable)->sizeIndex]));
 }   
-void checkRehash(void *hashTable, void *data)
+int needsRehash(HashTable *ht)
 {
-   float lf = calcLf(hashTable); 
+   float lf = calcLf(ht); 
 
-   if((((HashTable*)hashTable)->numSizes > 
-      (((HashTable*)hashTable)->sizeIndex + 1)) &&
-      (((HashTable*)hashTable)->rehashLoadFactor < lf) &
-      (((HashTable*)hashTable)->rehashLoadFactor!=1))
+   return (ht->numSizes > (ht->sizeIndex + 1)) &&
+      (ht->rehashLoadFactor < lf) &&
+      (ht->rehashLoadFactor != 1);
+}
+/* A shrink must leave the table below the rehash load factor at the smaller
+ * size (strictly, so open addressing keeps an empty slot) or the next htAdd
+ * would grow it straight back.
+ */
+int needsShrink(HashTable *ht)
+{
+   return ht->shrinkLoadFactor > 0 && ht->sizeIndex > 0 &&
+      calcLf(ht) < ht->shrinkLoadFactor &&
+      htUniqueEntries(ht) <
+      ht->rehashLoadFactor * ht->sizes[ht->sizeIndex - 1];
+}
+void checkRehash(void *hashTable, void *data)
+{
+   if(needsRehash(hashTable))
       rehash(hashTable, data);
 }
 
@@ -161,6 +363,44 @@ void entryCount(void *hashTable, unsigned tot, unsigned unq)
    ((HashTable*)hashTable)->uniqueEntries += unq;
 }
 
+/* The data an engine stores for a new entry: the data added, or during
+ * htFindOrInsert the object FNMaterialize makes from the probe.
+ */
+void* newData(HashTable *ht, void *data)
+{
+   if(ht->materialize != NULL)
+   {
+      data = ht->materialize(data, ht->materializeContext);
+      assert(data != NULL);
+   }
+   ht->dataBytes += ownedDataSize(ht, data);
+   ht->addedData = data;
+   return data;
+}
+
+/* Counts one more add of a stored entry, returning its frequency. */
+unsigned addDuplicate(HashTable *ht, HTEntry *entry)
+{
+   entryCount(ht, 1, 0);
+   ht->addedData = entry->data;
+   return ++entry->frequency;
+}
+
+/* Lowers the frequency of a stored entry by count, at most down to 0, and
+ * keeps the counts exact. Returns nonzero when the entry has to go.
+ */
+int lowerFrequency(HashTable *ht, HTEntry *entry, unsigned count)
+{
+   if(count > entry->frequency)
+      count = entry->frequency;
+   entry->frequency -= count;
+   ht->totalEntries -= count;
+   if(entry->frequency)
+      return 0;
+   ht->uniqueEntries--;
+   return 1;
+}
+
 unsigned dataCompare(void *hashTable, void *data1, void *data2)
 {
    return ((HashTable*)hashTable)->functions->compare(data1, data2);
@@ -169,26 +409,45 @@ unsigned dataCompare(void *hashTable, void *data1, void *data2)
 unsigned checkDuplicate(
    void *hashTable,
    HashNode *listNode,
-   void *data)
+   void *data,
+   unsigned hash)
 {
-   if(dataCompare(hashTable, data,
-      listNode->entry->data )==0) 
-   {
-      entryCount(hashTable, 1, 0);
-      listNode->entry->frequency++;
-      return listNode->entry->frequency;
-   }   
+   if(listNode->hash == hash && dataCompare(hashTable, data,
+      listNode->entry.data )==0) 
+      return addDuplicate(hashTable, &listNode->entry);
    return 0;
 }   
 
-HashNode* initDataNode(void *data)
+/* The table's own copy of a string key: inline in the node when it fits,
+ * otherwise spilled to the heap.
+ */
+void* copyKey(HashTable *ht, HashNode *node, const char *key)
+{
+   size_t size = strlen(key) + 1;
+   char *copy = inlineKey(node);
+
+   if(size > ht->inlineKeyBytes)
+   {
+      if((copy = malloc(size)) == NULL)
+         mallocError();
+      ht->keyBytes += size;
+      ht->keyAllocs++;
+   }
+   memcpy(copy, key, size);
+   return copy;
+}
+
+HashNode* initDataNode(void *hashTable, void *data, unsigned hash)
 {
+   HashTable *ht = hashTable;
    HashNode *dataNode;
-   dataNode = (HashNode*)malloc(sizeof(HashNode));
+   dataNode = allocNode(&ht->pool);
    dataNode->next = NULL;
-   dataNode->entry = (HTEntry*)malloc(sizeof(HTEntry));
-   dataNode->entry->data = data;
-   dataNode->entry->frequency = 1;
+   dataNode->hash = hash;
+   dataNode->entry.data = newData(ht, data);
+   if(ht->inlineKeyBytes)
+      dataNode->entry.data = copyKey(ht, dataNode, data);
+   dataNode->entry.frequency = 1;
    return dataNode;
 }
 
@@ -209,13 +468,16 @@ int testAscSize(int numSizes, unsigned *sizes)
 
    return 1;      
 }   
-void asserts(int numSizes, unsigned *sizes, float rehashLoadFactor)
+void asserts(int numSizes, unsigned *sizes, float rehashLoadFactor,
+   float shrinkLoadFactor)
 {
    assert(numSizes >= 1);
    if (numSizes > 1)
       assert(testAscSize(numSizes, sizes));
    assert((rehashLoadFactor > 0) && (rehashLoadFactor <= 1));
    assert(sizes[0] != 0);
+   assert(shrinkLoadFactor >= 0 && (shrinkLoadFactor == 0 ||
+      shrinkLoadFactor < rehashLoadFactor));
 }
 
 void cpyFunctions(HashTable *hashTable, HTFunctions *functions)
@@ -225,29 +487,110 @@ void cpyFunctions(HashTable *hashTable, HTFunctions *functions)
    *(hashTable->functions) = *functions;   
 }
 
-void* htCreate(
-   HTFunctions *functions,
-   unsigned sizes[],
-   int numSizes,
-   float rehashLoadFactor)
+unsigned log2Size(unsigned size)
 {
-   HashTable *ht = (HashTable*)malloc(sizeof(HashTable));
-   if(ht == NULL)
+   unsigned bits = 0;
+
+   assert(size && (size & (size - 1)) == 0);
+   while(size >>= 1)
+      bits++;
+   return bits;
+}
+
+void initIndex(HashTable *ht, HTIndexMode indexMode)
+{
+   int i;
+
+   ht->indexMode = indexMode;
+   ht->reciprocals = malloc(ht->numSizes * sizeof(uint64_t));
+   ht->shifts = malloc(ht->numSizes * sizeof(unsigned));
+   if(ht->reciprocals == NULL || ht->shifts == NULL)
       mallocError();
-      
-   asserts(numSizes, sizes, rehashLoadFactor);
 
-   ht->functions = functions;
+   for(i = 0; i < ht->numSizes; i++)
+   {
+      ht->reciprocals[i] = UINT64_MAX / ht->sizes[i] + 1;
+      ht->shifts[i] = 0;
+      if(indexMode == HT_INDEX_FIBONACCI)
+         ht->shifts[i] = 32 - log2Size(ht->sizes[i]);
+   }
+}
+
+void initTable(HashTable *ht, HTFunctions *functions, unsigned sizes[],
+   int numSizes, float rehashLoadFactor, const HTOptions *options)
+{
+   asserts(numSizes, sizes, rehashLoadFactor, options->shrinkLoadFactor);
+
+   cpyFunctions(ht, functions);
    ht->numSizes = numSizes;
    ht->rehashLoadFactor = rehashLoadFactor;
+   ht->shrinkLoadFactor = options->shrinkLoadFactor;
    ht->totalEntries = 0;
    ht->uniqueEntries = 0;
    ht->sizeIndex = 0;
+   ht->arr = NULL;
+   ht->oldArr = NULL;
+   ht->incrementalRehash = 0;
+   ht->rehashThreads = 1;
+   ht->chainOrder = HT_CHAIN_INSERTION;
+   ht->inlineKeyBytes = 0;
+   ht->strings = NULL;
+   ht->materialize = NULL;
+   ht->dataSize = options->dataSize;
+   ht->dataBytes = 0;
+   ht->keyBytes = 0;
+   ht->keyAllocs = 0;
+   initPool(&ht->pool, sizeof(HashNode));
 
    if((ht->sizes = (unsigned*)malloc(numSizes * sizeof(unsigned)))==NULL)
       mallocError();
 
    cpyArr(numSizes, ht->sizes, sizes);
+   initIndex(ht, options->indexMode);
+   assert(options->bloomFalsePositiveRate >= 0 &&
+      options->bloomFalsePositiveRate < 1);
+   initBloom(ht, options->bloomFalsePositiveRate);
+}
+
+void freeTable(HashTable *ht)
+{
+   freeArena(ht);
+   free(ht->bloom);
+   free(ht->functions);
+   free(ht->reciprocals);
+   free(ht->shifts);
+   free(ht->sizes);
+   free(ht);
+}
+
+/* Each node gets inlineKeyBytes rounded up so the next node stays aligned. */
+void initInlineKeys(HashTable *ht, unsigned inlineKeyBytes)
+{
+   size_t align = sizeof(void*);
+
+   assert(inlineKeyBytes == 0 || ht->functions->destroy == NULL);
+   ht->inlineKeyBytes = (unsigned)((inlineKeyBytes + align - 1) / align *
+      align);
+   initPool(&ht->pool, sizeof(HashNode) + ht->inlineKeyBytes);
+}
+
+HashTable* chainCreate(
+   HTFunctions *functions,
+   unsigned sizes[],
+   int numSizes,
+   float rehashLoadFactor,
+   const HTOptions *options)
+{
+   HashTable *ht = (HashTable*)malloc(sizeof(HashTable));
+   if(ht == NULL)
+      mallocError();
+      
+   initTable(ht, functions, sizes, numSizes, rehashLoadFactor, options);
+   ht->engine = &chainEngine;
+   ht->incrementalRehash = options->incrementalRehash;
+   ht->rehashThreads = options->rehashThreads;
+   ht->chainOrder = options->chainOrder;
+   initInlineKeys(ht, options->inlineKeyBytes);
 
    ht->arr = calloc(sizes[ht->sizeIndex], sizeof(HashNode*));
    if(ht->arr == NULL)
@@ -256,86 +599,345 @@ void* htCreate(
    return ht;
 }
 
+void chainMemoryUsage(HashTable *ht, HTMemoryUsage *usage,
+   unsigned *allocations)
+{
+   usage->tableBytes += sizeof(HashTable);
+   usage->bucketBytes += htCapacity(ht) * sizeof(HashNode*);
+   usage->nodeBytes += ht->pool.bytes;
+   *allocations += 2 + ht->pool.numSlabs;
+   if(ht->oldArr)
+   {
+      usage->bucketBytes += ht->oldSize * sizeof(HashNode*);
+      (*allocations)++;
+   }
+}
+
+void chainDestroy(HashTable *ht)
+{
+   destroyPool(&ht->pool, ht);
+   free(ht->oldArr);
+   free(ht->arr);
+   freeTable(ht);
+}
+
+void htDefaultOptions(HTOptions *options)
+{
+   options->engine = HT_ENGINE_CHAIN;
+   options->incrementalRehash = 0;
+   options->rehashThreads = 1;
+   options->indexMode = HT_INDEX_MODULO;
+   options->chainOrder = HT_CHAIN_INSERTION;
+   options->shrinkLoadFactor = 0;
+   options->bloomFalsePositiveRate = 0;
+   options->inlineKeyBytes = 0;
+   options->dataSize = NULL;
+}
+
+void* htCreateEx(
+   HTFunctions *functions,
+   unsigned sizes[],
+   int numSizes,
+   float rehashLoadFactor,
+   const HTOptions *options)
+{
+   HTOptions defaults;
+
+   if(options == NULL)
+   {
+      htDefaultOptions(&defaults);
+      options = &defaults;
+   }
+   assert(options->inlineKeyBytes == 0 ||
+      options->engine == HT_ENGINE_CHAIN);
+   if(options->engine == HT_ENGINE_ROBIN_HOOD)
+      return rhCreate(functions, sizes, numSizes, rehashLoadFactor, options);
+   if(options->engine == HT_ENGINE_SWISS)
+      return swissCreate(functions, sizes, numSizes, rehashLoadFactor,
+         options);
+   if(options->engine == HT_ENGINE_CONCURRENT)
+      return concurrentCreate(functions, sizes, numSizes, rehashLoadFactor,
+         options);
+   return chainCreate(functions, sizes, numSizes, rehashLoadFactor, options);
+}
+
+void* htCreate(
+   HTFunctions *functions,
+   unsigned sizes[],
+   int numSizes,
+   float rehashLoadFactor)
+{
+   return htCreateEx(functions, sizes, numSizes, rehashLoadFactor, NULL);
+}
+
 void htDestroy(void *hashTable)
 {
-   destroyArr(
-      ((HashTable*)hashTable)->arr, 
-      ((HashTable*)hashTable)->sizes[((HashTable*)hashTable)->sizeIndex],
-      ((HashTable*)hashTable)->functions->destroy);
-   free(((HashTable*)hashTable)->sizes);
-   free((HashTable*)hashTable);
+   ((HashTable*)hashTable)->engine->destroy(hashTable);
 }
 
-unsigned htAdd(void *hashTable, void *data)
+void moveToFront(HashTable *ht, unsigned index, HashNode *prevNode,
+   HashNode *node)
+{
+   if(prevNode == NULL)
+      return;
+   prevNode->next = node->next;
+   node->next = ht->arr[index];
+   ht->arr[index] = node;
+}
+
+/* Promotes the node past lower-frequency predecessors: it is relinked just
+ * before the first node from the head with a lower frequency, so every node
+ * ahead of it has at least its frequency. Nothing is done when the
+ * predecessor's frequency is not lower. Chains are not always sorted by
+ * frequency, since rehashing, incremental migration and merges splice nodes
+ * without reordering them, and nothing here relies on it.
+ */
+void moveByFrequency(HashTable *ht, unsigned index, HashNode *prevNode,
+   HashNode *node)
 {
-   unsigned hash;
+   HashNode **link = &ht->arr[index];
+
+   if(prevNode == NULL ||
+      prevNode->entry.frequency >= node->entry.frequency)
+      return;
+   while((*link)->entry.frequency >= node->entry.frequency)
+      link = &(*link)->next;
+   prevNode->next = node->next;
+   node->next = *link;
+   *link = node;
+}
+
+/* Applies the chain order policy after the frequency of node was
+ * incremented by htAdd.
+ */
+void reorderChain(HashTable *ht, unsigned index, HashNode *prevNode,
+   HashNode *node)
+{
+   if(ht->chainOrder == HT_CHAIN_MOVE_TO_FRONT)
+      moveToFront(ht, index, prevNode, node);
+   else if(ht->chainOrder == HT_CHAIN_BY_FREQUENCY)
+      moveByFrequency(ht, index, prevNode, node);
+}
+
+unsigned chainAdd(HashTable *hashTable, void *data, unsigned hash)
+{
+   unsigned index;
    unsigned freq = 0;
    HashNode *listNode, *dataNode;
    HashNode *prevNode = NULL;
 
-   assert(data);
-
    checkRehash(hashTable, data);
+   stepMigration(hashTable, hash);
 
-   hash = getHash(hashTable, data);
-   listNode = ((HashTable*)hashTable)->arr[hash];
+   index = getIndex(hashTable, hash);
+   listNode = ((HashTable*)hashTable)->arr[index];
    while(listNode)
    {  
-      freq += checkDuplicate(hashTable, listNode, data);
+      if((freq = checkDuplicate(hashTable, listNode, data, hash)) != 0)
+      {
+         reorderChain(hashTable, index, prevNode, listNode);
+         return freq;
+      }
       prevNode = listNode;
       listNode = listNode->next;
    }   
-   if(freq > 1)
-      return freq;
-   dataNode = initDataNode(data);
+   dataNode = initDataNode(hashTable, data, hash);
    if(prevNode)
       prevNode->next = dataNode;
    else
-      ((HashTable*)hashTable)->arr[hash] = dataNode;
+      ((HashTable*)hashTable)->arr[index] = dataNode;
    entryCount(hashTable, 1, 1);
    return 1;
 }
 
+unsigned addHashed(HashTable *ht, void *data, unsigned hash)
+{
+   unsigned freq = ht->engine->add(ht, data, hash);
+
+   bloomAdded(ht, freq, hash);
+   return freq;
+}
+
+unsigned htAdd(void *hashTable, void *data)
+{
+   assert(data);
+   assert(!arenaOwnsData(hashTable));
+
+   return addHashed(hashTable, data, hashData(hashTable, data));
+}
+
 void setEntry(HTEntry *entry, HashNode *listNode)
 {
-   entry->data = listNode->entry->data;
-   entry->frequency = listNode->entry->frequency;
+   entry->data = listNode->entry.data;
+   entry->frequency = listNode->entry.frequency;
 }
 
-void compareEntries(void* hashTable, HTEntry *entry, 
-   HashNode *listNode, void* data)
+int compareEntries(void* hashTable, HTEntry *entry, 
+   HashNode *listNode, void* data, unsigned hash)
 {
-   if (!(dataCompare(hashTable, listNode->entry->data, data))) 
+   if (listNode->hash == hash &&
+      !(dataCompare(hashTable, listNode->entry.data, data))) 
+   {
       setEntry(entry, listNode);   
+      return 1;
+   }
+   return 0;
 }
 
-void searchLinks(void* hashTable, HTEntry *entry, 
-   HashNode *listNode, void* data)
+/* Returns the matching node, if any, and its predecessor through prevNode.
+ */
+HashNode* searchLinks(void* hashTable, HTEntry *entry, 
+   HashNode *listNode, void* data, unsigned hash, HashNode **prevNode)
 {
+   *prevNode = NULL;
    do{ 
-      compareEntries(hashTable, entry, listNode, data);      
+      if(compareEntries(hashTable, entry, listNode, data, hash))
+         return listNode;
+      *prevNode = listNode;
       listNode = listNode->next;
    } while(listNode);
+   return NULL;
 }
 
-HTEntry htLookUp(void *hashTable, void *data)
+HTEntry chainLookUp(HashTable *hashTable, void *data, unsigned hash)
 {
-   HashNode *listNode;
+   HashNode *listNode, *prevNode;
    HTEntry entry;
+   unsigned index;
    entry.data = NULL;
    entry.frequency = 0;
 
-   assert(data != NULL);
-   listNode = ((HashTable*)hashTable)->arr[getHash(hashTable, data)];
+   stepMigration(hashTable, hash);
+   index = getIndex(hashTable, hash);
+   listNode = ((HashTable*)hashTable)->arr[index];
    
    if(!listNode)
       return entry;
 
-   searchLinks(hashTable, &entry, listNode, data);
+   listNode = searchLinks(hashTable, &entry, listNode, data, hash,
+      &prevNode);
+   if(listNode && hashTable->chainOrder == HT_CHAIN_MOVE_TO_FRONT)
+      moveToFront(hashTable, index, prevNode, listNode);
+
+   return entry;
+}
+
+HTEntry htFindOrInsert(void *hashTable, const void *probe, FNMaterialize make,
+   void *context)
+{
+   HashTable *ht = hashTable;
+   HTEntry entry;
+
+   assert(probe != NULL && make != NULL);
+   assert(ht->engine != &concurrentEngine);
+   assert(ht->inlineKeyBytes == 0 && !arenaOwnsData(ht));
+
+   ht->materialize = make;
+   ht->materializeContext = context;
+   entry.frequency = addHashed(ht, (void*)probe, hashData(ht, (void*)probe));
+   ht->materialize = NULL;
+   entry.data = ht->addedData;
+   return entry;
+}
+
+HTEntry lookUpHashed(HashTable *ht, void *data, unsigned hash)
+{
+   HTEntry entry;
+
+   if(ht->bloom != NULL && !bloomMayContain(ht, hash))
+   {
+      entry.data = NULL;
+      entry.frequency = 0;
+      return entry;
+   }
+   return ht->engine->lookUp(ht, data, hash);
+}
+
+HTEntry htLookUp(void *hashTable, void *data)
+{
+   assert(data != NULL);
+
+   return lookUpHashed(hashTable, data, hashData(hashTable, data));
+}
+
+/* Moves a node whose frequency was lowered behind every node with a higher
+ * frequency. link is the pointer to the node.
+ */
+void sinkByFrequency(HashNode **link, HashNode *node)
+{
+   *link = node->next;
+   while(*link && (*link)->entry.frequency > node->entry.frequency)
+      link = &(*link)->next;
+   node->next = *link;
+   *link = node;
+}
+
+HTEntry chainRemove(HashTable *ht, void *data, unsigned hash, unsigned count)
+{
+   HashNode **link, *node;
+   HTEntry entry;
+
+   entry.data = NULL;
+   entry.frequency = 0;
+   stepMigration(ht, hash);
+
+   for(link = &ht->arr[getIndex(ht, hash)]; (node = *link); link = &node->next)
+   {
+      if(node->hash != hash || dataCompare(ht, data, node->entry.data) != 0)
+         continue;
+      if(lowerFrequency(ht, &node->entry, count))
+      {
+         *link = node->next;
+         entry = node->entry;
+         if(ht->inlineKeyBytes)
+         {
+            forgetNode(ht, node);
+            freeNode(ht, node);
+            entry.data = data;
+         }
+         releaseNode(&ht->pool, node);
+         return entry;
+      }
+      if(ht->chainOrder == HT_CHAIN_BY_FREQUENCY)
+         sinkByFrequency(link, node);
+      return node->entry;
+   }
+   return entry;
+}
+
+HTEntry removeData(HashTable *ht, void *data, unsigned count)
+{
+   HTEntry entry;
+
+   assert(data != NULL);
+   assert(ht->engine->remove != NULL);
 
+   entry = ht->engine->remove(ht, data, hashData(ht, data), count);
+   if(entry.data != NULL && entry.frequency == 0)
+   {
+      ht->dataBytes -= ownedDataSize(ht, entry.data);
+      if(needsShrink(ht))
+         ht->engine->resize(ht, ht->sizeIndex - 1);
+      bloomRemoved(ht);
+   }
    return entry;
 }
 
+void* htRemove(void *hashTable, void *data)
+{
+   return removeData(hashTable, data, UINT_MAX).data;
+}
+
+unsigned htDecrement(void *hashTable, void *data)
+{
+   HTEntry entry = removeData(hashTable, data, 1);
+
+   if(entry.data != NULL && entry.frequency == 0 &&
+      !((HashTable*)hashTable)->inlineKeyBytes)
+      freeData(hashTable, entry.data);
+   return entry.frequency;
+}
+
 void copyEntry(HTEntry *dest, HTEntry src)
 {
    dest->frequency = src.frequency;
@@ -347,7 +949,7 @@ void checkLinks2(HashNode* node, HTEntry* entryArr, int *j)
    HashNode *listNode = node;
    while(listNode)
    {
-      copyEntry(&entryArr[(*j)], *(listNode->entry));
+      copyEntry(&entryArr[(*j)], listNode->entry);
       (*j)++;
       listNode = listNode->next;
    }     
@@ -359,18 +961,74 @@ void checkIndex2(HashNode* node, HTEntry* entryArr, int *j)
       checkLinks2(node, entryArr, j);
 }
 
-void scanArr(HTEntry *entryArr, void *hashTable)
+void scanArr(HashTable *hashTable, HTEntry *entryArr, unsigned size)
 {
    int i=0;
    int j=0;
+
+   finishMigration(hashTable);
    
-   while(j < htUniqueEntries(hashTable) && i < htCapacity(hashTable))
+   while(j < size && i < htCapacity(hashTable))
    {
       checkIndex2(((HashTable*)hashTable)->arr[i],entryArr, &j);
       i++;
    }   
 }
 
+HTEntry* chainIterNext(HashTable *ht, HTIter *iter, unsigned *hash)
+{
+   HashNode *node = iter->position;
+
+   finishMigration(ht);
+   if(node != NULL)
+      node = node->next;
+   else if(iter->bucket < htCapacity(ht))
+      node = ht->arr[iter->bucket];
+   else
+      iter->bucket = htCapacity(ht);
+   while(node == NULL && iter->bucket + 1 < htCapacity(ht))
+      node = ht->arr[++iter->bucket];
+
+   if((iter->position = node) == NULL)
+   {
+      iter->bucket = htCapacity(ht);
+      return NULL;
+   }
+   if(hash != NULL)
+      *hash = node->hash;
+   return &node->entry;
+}
+
+void htIterBegin(void *hashTable, HTIter *iter, unsigned bucket)
+{
+   iter->hashTable = hashTable;
+   iter->bucket = bucket;
+   iter->position = NULL;
+}
+
+HTEntry* htIterNext(HTIter *iter)
+{
+   HashTable *ht = iter->hashTable;
+
+   return ht->engine->iterNext(ht, iter, NULL);
+}
+
+unsigned htForEach(void *hashTable, FNVisit visit, void *context)
+{
+   HTIter iter;
+   HTEntry *entry;
+   unsigned count = 0;
+
+   htIterBegin(hashTable, &iter, 0);
+   while((entry = htIterNext(&iter)) != NULL)
+   {
+      count++;
+      if(visit(entry, context))
+         break;
+   }
+   return count;
+}
+
 HTEntry* htToArray(void *hashTable, unsigned *size)
 {
    HTEntry *entryArr;
@@ -380,7 +1038,7 @@ HTEntry* htToArray(void *hashTable, unsigned *size)
    
    if(!(entryArr = (HTEntry*)malloc((*size)* sizeof(HTEntry))))
       mallocError();
-   scanArr(entryArr, hashTable); 
+   ((HashTable*)hashTable)->engine->toArray(hashTable, entryArr, *size);
    
    return entryArr; 
 }
@@ -393,12 +1051,20 @@ unsigned htCapacity(void *hashTable)
 
 unsigned htUniqueEntries(void *hashTable)
 {
-   return ((HashTable*)hashTable)->uniqueEntries;
+   HashTable *ht = hashTable;
+
+   if(ht->engine->count != NULL)
+      return ht->engine->count(ht, 1);
+   return ht->uniqueEntries;
 }
 
 unsigned htTotalEntries(void *hashTable)
 {
-   return ((HashTable*)hashTable)->totalEntries;
+   HashTable *ht = hashTable;
+
+   if(ht->engine->count != NULL)
+      return ht->engine->count(ht, 0);
+   return ht->totalEntries;
 }
 
 void mCheckNodes(HashNode* node, HTMetrics *metrics)
@@ -432,10 +1098,12 @@ void mTraverseTable(void* hashTable, HTMetrics *metrics)
    for(i = 0; i < htCapacity(hashTable); i++)
       mCheckIndex(((HashTable*)hashTable)->arr[i], metrics);
 }   
-HTMetrics htMetrics(void *hashTable)
+HTMetrics chainMetrics(HashTable *hashTable)
 {
    HTMetrics metrics;
 
+   finishMigration(hashTable);
+
    metrics.maxChainLength = 0;
    metrics.numberOfChains = 0;
    metrics.avgChainLength = 0;
@@ -446,3 +1114,265 @@ HTMetrics htMetrics(void *hashTable)
 
    return metrics;
 }
+
+HTMetrics htMetrics(void *hashTable)
+{
+   return ((HashTable*)hashTable)->engine->metrics(hashTable);
+}
+
+void countProbe(unsigned *counts, unsigned numCounts, unsigned probes)
+{
+   if(counts == NULL)
+      return;
+   if(probes > numCounts)
+      probes = numCounts;
+   counts[probes - 1]++;
+}
+
+unsigned countChainProbes(HashNode *listNode, unsigned *counts,
+   unsigned numCounts)
+{
+   unsigned probes = 0;
+
+   for(; listNode; listNode = listNode->next)
+      countProbe(counts, numCounts, ++probes);
+   return probes;
+}
+
+unsigned chainProbeLengths(HashTable *ht, unsigned *counts,
+   unsigned numCounts)
+{
+   unsigned i, probes, maxProbes = 0;
+
+   finishMigration(ht);
+   for(i = 0; i < htCapacity(ht); i++)
+   {
+      probes = countChainProbes(ht->arr[i], counts, numCounts);
+      if(probes > maxProbes)
+         maxProbes = probes;
+   }
+   return maxProbes;
+}
+
+/* A miss walks a whole chain, so on average unique / capacity nodes. */
+double chainMissProbes(HashTable *ht)
+{
+   finishMigration(ht);
+   return (double)htUniqueEntries(ht) / htCapacity(ht);
+}
+
+unsigned htProbeLengths(void *hashTable, unsigned *counts, unsigned numCounts)
+{
+   unsigned i;
+
+   assert(numCounts >= 1);
+   for(i = 0; i < numCounts; i++)
+      counts[i] = 0;
+   return ((HashTable*)hashTable)->engine->probeLengths(hashTable, counts,
+      numCounts);
+}
+
+void chainPrefetch(HashTable *ht, unsigned hash, int depth)
+{
+   HashNode **bucket = &ht->arr[getIndex(ht, hash)];
+
+   if(depth == 0)
+      HT_PREFETCH(bucket);
+   else
+      HT_PREFETCH(*bucket);
+}
+
+/* Hashes and prefetches a block of data for the batch operations. */
+void prefetchBlock(HashTable *ht, void *data[], unsigned count,
+   unsigned hashes[])
+{
+   unsigned i;
+
+   for(i = 0; i < count; i++)
+   {
+      assert(data[i] != NULL);
+      hashes[i] = hashData(ht, data[i]);
+      ht->engine->prefetch(ht, hashes[i], 0);
+   }
+   for(i = 0; i < count; i++)
+      ht->engine->prefetch(ht, hashes[i], 1);
+}
+
+unsigned batchBlock(unsigned count, unsigned done)
+{
+   return count - done < BATCH_BLOCK ? count - done : BATCH_BLOCK;
+}
+
+void htAddBatch(void *hashTable, void *data[], unsigned count,
+   unsigned freqs[])
+{
+   HashTable *ht = hashTable;
+   unsigned hashes[BATCH_BLOCK], done, block, i, freq;
+
+   assert(!arenaOwnsData(ht));
+   for(done = 0; done < count; done += block)
+   {
+      block = batchBlock(count, done);
+      prefetchBlock(ht, data + done, block, hashes);
+      for(i = 0; i < block; i++)
+      {
+         freq = addHashed(ht, data[done + i], hashes[i]);
+         if(freqs != NULL)
+            freqs[done + i] = freq;
+      }
+   }
+}
+
+void htLookUpBatch(void *hashTable, void *data[], unsigned count,
+   HTEntry entries[])
+{
+   HashTable *ht = hashTable;
+   unsigned hashes[BATCH_BLOCK], done, block, i;
+
+   for(done = 0; done < count; done += block)
+   {
+      block = batchBlock(count, done);
+      prefetchBlock(ht, data + done, block, hashes);
+      for(i = 0; i < block; i++)
+         entries[done + i] = lookUpHashed(ht, data[done + i], hashes[i]);
+   }
+}
+
+const HTEngine chainEngine = {
+   chainAdd,
+   chainLookUp,
+   chainRemove,
+   chainResize,
+   chainPrefetch,
+   scanArr,
+   chainIterNext,
+   chainMetrics,
+   chainProbeLengths,
+   chainMissProbes,
+   chainMemoryUsage,
+   NULL,
+   chainDestroy
+};
+
+/* Links a node taken from another table into the chain at index, appending
+ * it as htAdd would, or folds its frequency into the matching entry. A
+ * folded node is returned for the caller to pass to dropNode, otherwise
+ * NULL is returned.
+ */
+HashNode* mergeNode(HashTable *ht, unsigned index, HashNode *node)
+{
+   HashNode *listNode = ht->arr[index], *prevNode = NULL;
+
+   for(; listNode; prevNode = listNode, listNode = listNode->next)
+   {
+      if(listNode->hash == node->hash &&
+         dataCompare(ht, node->entry.data, listNode->entry.data) == 0)
+      {
+         listNode->entry.frequency += node->entry.frequency;
+         if(ht->chainOrder == HT_CHAIN_BY_FREQUENCY)
+            moveByFrequency(ht, index, prevNode, listNode);
+         return node;
+      }
+   }
+   node->next = NULL;
+   if(prevNode)
+      prevNode->next = node;
+   else
+      ht->arr[index] = node;
+   if(ht->chainOrder == HT_CHAIN_BY_FREQUENCY)
+      moveByFrequency(ht, index, prevNode, node);
+   return NULL;
+}
+
+/* Rehashes to the given size index at once, without any migration. */
+void growTo(HashTable *ht, unsigned sizeIndex)
+{
+   unsigned incrementalRehash = ht->incrementalRehash;
+
+   ht->incrementalRehash = 0;
+   finishMigration(ht);
+   while(ht->sizeIndex < sizeIndex)
+      rehash(ht, NULL);
+   ht->incrementalRehash = incrementalRehash;
+}
+
+/* Grows after a merge as far as the load factor calls for. */
+void growMerged(HashTable *ht)
+{
+   while(needsRehash(ht))
+      growTo(ht, ht->sizeIndex + 1);
+}
+
+/* Adds the memory counts of a table about to be merged into ht, before any
+ * of its nodes are dropped.
+ */
+void adoptUsage(HashTable *ht, HashTable *src)
+{
+   ht->pool.bytes += src->pool.bytes;
+   ht->pool.numSlabs += src->pool.numSlabs;
+   ht->keyBytes += src->keyBytes;
+   ht->keyAllocs += src->keyAllocs;
+   ht->dataBytes += src->dataBytes;
+}
+
+/* Takes over the slabs of a table whose nodes have all been linked into ht
+ * or recycled, adds its total count and frees what is left of it. The
+ * caller counts the unique entries as it links them.
+ */
+void adoptTable(HashTable *ht, HashTable *src)
+{
+   NodeSlab **link = &ht->pool.slabs;
+   HashNode *node, *next;
+
+   while(*link)
+      link = &(*link)->next;
+   *link = src->pool.slabs;
+   for(node = src->pool.freeList; node; node = next)
+   {
+      next = node->next;
+      releaseNode(&ht->pool, node);
+   }
+   entryCount(ht, src->totalEntries, 0);
+   adoptArena(ht, src);
+   free(src->arr);
+   freeTable(src);
+}
+
+void checkMergeable(HashTable *dst, HashTable *src)
+{
+   assert(dst != src);
+   assert(dst->engine == &chainEngine && src->engine == &chainEngine);
+   assert(dst->functions->hash == src->functions->hash);
+   assert(dst->inlineKeyBytes == src->inlineKeyBytes);
+   assert(arenaOwnsData(dst) == arenaOwnsData(src));
+   assert(dst->dataSize == src->dataSize);
+}
+
+void htMerge(void *dst, void *src)
+{
+   HashTable *ht = dst, *from = src;
+   HashNode *node, *next;
+   unsigned i;
+
+   checkMergeable(ht, from);
+   finishMigration(ht);
+   finishMigration(from);
+   adoptUsage(ht, from);
+
+   for(i = 0; i < htCapacity(from); i++)
+   {
+      for(node = from->arr[i]; node; node = next)
+      {
+         next = node->next;
+         if(mergeNode(ht, getIndex(ht, node->hash), node) != NULL)
+            dropNode(ht, node);
+         else
+         {
+            entryCount(ht, 0, 1);
+            growMerged(ht);
+         }
+      }
+   }
+   adoptTable(ht, from);
+   bloomRefresh(ht);
+}
@@ -0,0 +1,106 @@
+#include "hashTable.h"
+#include "hashTablePriv.h"
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* The string arena behind htAddString. Each key is first copied, NUL
+ * terminated, to the top of the arena: FNHash and FNCompare need a string
+ * and the bytes are then already where a new key is kept. When the key
+ * turns out to be present the copy is taken back by lowering used again,
+ * so a duplicate costs a memcpy but never an allocation. Chunks double in
+ * size up to MAX_CHUNK, the rest of a chunk too full for the next key is
+ * left unused.
+ */
+#define MIN_CHUNK 4096
+#define MAX_CHUNK (1u << 20)
+
+/* Keys stay in the arena for the life of the table unless the table copies
+ * them itself (inlineKeyBytes), in which case the arena is scratch space.
+ */
+int arenaOwnsData(HashTable *ht)
+{
+   return ht->strings != NULL && ht->inlineKeyBytes == 0;
+}
+
+void addChunk(HashTable *ht, size_t need)
+{
+   size_t size = MIN_CHUNK;
+   ArenaChunk *chunk;
+
+   if(ht->strings != NULL)
+      size = ht->strings->size < MAX_CHUNK ? ht->strings->size * 2 :
+         MAX_CHUNK;
+   if(size < need)
+      size = need;
+   if((chunk = malloc(sizeof(ArenaChunk) - 1 + size)) == NULL)
+      mallocError();
+   ht->keyBytes += sizeof(ArenaChunk) - 1 + size;
+   ht->keyAllocs++;
+   chunk->size = size;
+   chunk->used = 0;
+   chunk->next = ht->strings;
+   ht->strings = chunk;
+}
+
+char* arenaPush(HashTable *ht, const char *s, size_t len)
+{
+   char *copy;
+
+   if(ht->strings == NULL || ht->strings->size - ht->strings->used <= len)
+      addChunk(ht, len + 1);
+   copy = ht->strings->bytes + ht->strings->used;
+   memcpy(copy, s, len);
+   copy[len] = '\0';
+   ht->strings->used += len + 1;
+   return copy;
+}
+
+/* Takes back the copy arenaPush just made. */
+void arenaPop(HashTable *ht, size_t len)
+{
+   ht->strings->used -= len + 1;
+}
+
+/* Appends the chunks of src behind those of ht, so ht keeps filling its
+ * current chunk.
+ */
+void adoptArena(HashTable *ht, HashTable *src)
+{
+   ArenaChunk **link = &ht->strings;
+
+   while(*link)
+      link = &(*link)->next;
+   *link = src->strings;
+   src->strings = NULL;
+}
+
+void freeArena(HashTable *ht)
+{
+   ArenaChunk *chunk, *next;
+
+   for(chunk = ht->strings; chunk != NULL; chunk = next)
+   {
+      next = chunk->next;
+      free(chunk);
+   }
+   ht->strings = NULL;
+}
+
+unsigned htAddString(void *hashTable, const char *s, size_t len)
+{
+   HashTable *ht = hashTable;
+   unsigned freq;
+   char *key;
+
+   assert(s != NULL);
+   assert(ht->engine != &concurrentEngine);
+   assert(ht->inlineKeyBytes || ht->strings != NULL ||
+      htUniqueEntries(ht) == 0);
+
+   key = arenaPush(ht, s, len);
+   freq = addHashed(ht, key, hashData(ht, key));
+   if(freq > 1 || ht->inlineKeyBytes)
+      arenaPop(ht, len);
+   return freq;
+}
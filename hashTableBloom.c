@@ -0,0 +1,164 @@
+#include "hashTable.h"
+#include "hashTablePriv.h"
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+/* A blocked Bloom filter in front of htLookUp. Each key sets and tests
+ * bloomHashes bits within a single 512 bit block (one cache line), so a
+ * negative lookup costs one cache miss instead of a bucket load and a chain
+ * walk. All bits are derived from the cached hash, which lets the filter be
+ * rebuilt without calling FNHash.
+ *
+ * The filter is designed for bloomEntries entries at the requested false
+ * positive rate. It is rebuilt for twice the unique entries whenever it
+ * outgrows that, and also when removals have left three quarters of its
+ * design unused, since removed entries keep their bits until a rebuild.
+ */
+#define BLOCK_BITS 512
+#define BLOCK_WORDS (BLOCK_BITS / 64)
+#define MIN_BLOOM_ENTRIES 64
+#define MAX_BLOOM_HASHES 16
+#define LN2 0.69314718055994530942
+
+/* The murmur3 finalizer. */
+unsigned bloomMix(unsigned h)
+{
+   h ^= h >> 16;
+   h = (h * 0x85EBCA6Bu) & 0xFFFFFFFFu;
+   h ^= h >> 13;
+   h = (h * 0xC2B2AE35u) & 0xFFFFFFFFu;
+   return h ^ (h >> 16);
+}
+
+uint64_t* bloomBlock(HashTable *ht, unsigned mixed)
+{
+   return ht->bloom +
+      (((uint64_t)mixed * ht->bloomBlocks) >> 32) * BLOCK_WORDS;
+}
+
+/* Bit i of a key is h1 + i * h2 within its block (double hashing). */
+void bloomAdd(HashTable *ht, unsigned hash)
+{
+   unsigned mixed = bloomMix(hash), h2, bit, i;
+   uint64_t *block = bloomBlock(ht, mixed);
+
+   bit = bloomMix(mixed ^ 0x5BD1E995u);
+   h2 = (bit >> 16) | 1;
+   for(i = 0; i < ht->bloomHashes; i++, bit += h2)
+      block[(bit % BLOCK_BITS) / 64] |= (uint64_t)1 << (bit % 64);
+}
+
+int bloomMayContain(HashTable *ht, unsigned hash)
+{
+   unsigned mixed = bloomMix(hash), h2, bit, i;
+   uint64_t *block = bloomBlock(ht, mixed);
+
+   bit = bloomMix(mixed ^ 0x5BD1E995u);
+   h2 = (bit >> 16) | 1;
+   for(i = 0; i < ht->bloomHashes; i++, bit += h2)
+      if(!(block[(bit % BLOCK_BITS) / 64] & ((uint64_t)1 << (bit % 64))))
+         return 0;
+   return 1;
+}
+
+/* Allocates a clear filter for the number of entries. A standard filter
+ * needs -ln(p) / ln(2)^2 bits per entry and ln(2) bits per entry hashes.
+ * Blocks fill unevenly, which hurts more the more bits each entry needs, so
+ * a blocked filter gets bits^2 / 64 bits per entry extra.
+ */
+void bloomAlloc(HashTable *ht, unsigned entries)
+{
+   double bitsPerEntry = -log(ht->bloomRate) / (LN2 * LN2);
+   unsigned hashes = (unsigned)(bitsPerEntry * LN2 + 0.5);
+   double blocks;
+
+   bitsPerEntry += bitsPerEntry * bitsPerEntry / 64;
+   blocks = ceil(entries * bitsPerEntry / BLOCK_BITS);
+
+   ht->bloomEntries = entries;
+   ht->bloomBlocks = blocks < 1 ? 1 : (unsigned)blocks;
+   ht->bloomHashes = hashes < 1 ? 1 :
+      hashes > MAX_BLOOM_HASHES ? MAX_BLOOM_HASHES : hashes;
+   ht->bloom = calloc(ht->bloomBlocks, BLOCK_WORDS * sizeof(uint64_t));
+   if(ht->bloom == NULL)
+      mallocError();
+}
+
+void initBloom(HashTable *ht, float falsePositiveRate)
+{
+   double entries = ht->rehashLoadFactor * ht->sizes[0];
+
+   ht->bloom = NULL;
+   ht->bloomEntries = 0;
+   ht->bloomBlocks = 0;
+   ht->bloomHashes = 0;
+   if((ht->bloomRate = falsePositiveRate) == 0)
+      return;
+   bloomAlloc(ht, entries < MIN_BLOOM_ENTRIES ? MIN_BLOOM_ENTRIES :
+      (unsigned)entries);
+}
+
+void bloomAddChains(HashTable *ht, HashNode **arr, unsigned size)
+{
+   HashNode *node;
+   unsigned i;
+
+   for(i = 0; i < size; i++)
+      for(node = arr[i]; node; node = node->next)
+         bloomAdd(ht, node->hash);
+}
+
+/* The chaining engine's cursor would finish an incremental rehash first,
+ * so its entries are read from both bucket arrays as they are instead.
+ */
+void bloomRebuild(HashTable *ht)
+{
+   unsigned entries = 2 * htUniqueEntries(ht), hash;
+   HTIter iter;
+
+   free(ht->bloom);
+   bloomAlloc(ht, entries < MIN_BLOOM_ENTRIES ? MIN_BLOOM_ENTRIES : entries);
+   if(ht->engine == &chainEngine)
+   {
+      bloomAddChains(ht, ht->arr, htCapacity(ht));
+      if(ht->oldArr)
+         bloomAddChains(ht, ht->oldArr, ht->oldSize);
+      return;
+   }
+   htIterBegin(ht, &iter, 0);
+   while(ht->engine->iterNext(ht, &iter, &hash) != NULL)
+      bloomAdd(ht, hash);
+}
+
+/* Called after every add with its result. */
+void bloomAdded(HashTable *ht, unsigned freq, unsigned hash)
+{
+   if(ht->bloom == NULL || freq != 1)
+      return;
+   if(htUniqueEntries(ht) > ht->bloomEntries)
+      bloomRebuild(ht);
+   else
+      bloomAdd(ht, hash);
+}
+
+void bloomRemoved(HashTable *ht)
+{
+   if(ht->bloom != NULL && ht->bloomEntries > MIN_BLOOM_ENTRIES &&
+      htUniqueEntries(ht) < ht->bloomEntries / 4)
+      bloomRebuild(ht);
+}
+
+/* After entries have been linked in wholesale (htMerge). */
+void bloomRefresh(HashTable *ht)
+{
+   if(ht->bloom != NULL)
+      bloomRebuild(ht);
+}
+
+size_t bloomBytes(HashTable *ht)
+{
+   if(ht->bloom == NULL)
+      return 0;
+   return (size_t)ht->bloomBlocks * BLOCK_WORDS * sizeof(uint64_t);
+}
@@ -0,0 +1,517 @@
+#define _GNU_SOURCE
+#include "hashTable.h"
+#include "hashTablePriv.h"
+#include <pthread.h>
+#include <sched.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+/* A chaining engine shared by many threads without external locking.
+ *
+ * Lookups take no lock. The bucket array and the size index it was built for
+ * are published together through one pointer, and a sequence counter (a
+ * seqlock) is odd while a rehash relinks nodes. A search never waits for
+ * the rehash: a hit is returned at once, even from a half relinked chain,
+ * because nodes are neither freed nor reused while the table exists, and
+ * only a miss made while the counter was odd or moved is retried.
+ *
+ * htAdd increments the frequency of an existing entry atomically. On a miss
+ * it holds the resize lock shared, so any number of threads insert at once,
+ * and pushes the new node on the head of its chain with a compare and swap,
+ * searching the nodes another thread pushed first whenever that fails. A
+ * rehash holds the resize lock exclusively and appends every node to its new
+ * chain in the old order, so pointers only ever lead to nodes relinked later
+ * and a lookup walking a half relinked chain can miss but never loop. Old
+ * bucket arrays are kept until htDestroy since a lookup may still be in one.
+ *
+ * Nodes come from per-CPU shards, each with its own pool and lock, and the
+ * entry counts are kept per shard on separate cache lines.
+ */
+#define NUM_SHARDS 16
+#define CACHE_LINE 64
+
+#define LOAD(ptr) __atomic_load_n(ptr, __ATOMIC_ACQUIRE)
+#define STORE(ptr, val) __atomic_store_n(ptr, val, __ATOMIC_RELEASE)
+
+typedef struct buckets
+{
+   struct buckets *retired;
+   unsigned sizeIndex;
+   HashNode *heads[1];
+} Buckets;
+
+typedef struct
+{
+   unsigned totalEntries, uniqueEntries;
+   size_t dataBytes;
+   pthread_mutex_t lock;
+   NodePool pool;
+   char pad[CACHE_LINE];
+} Shard;
+
+typedef struct
+{
+   HashTable base;
+   Buckets *buckets;
+   unsigned seq;
+   pthread_rwlock_t resizeLock;
+   Shard shards[NUM_SHARDS];
+} ConcurrentTable;
+
+Shard* localShard(ConcurrentTable *ct)
+{
+#ifdef __linux__
+   int cpu = sched_getcpu();
+
+   if(cpu >= 0)
+      return &ct->shards[cpu % NUM_SHARDS];
+#endif
+   return &ct->shards[0];
+}
+
+void shardCount(Shard *shard, unsigned tot, unsigned unq)
+{
+   __atomic_add_fetch(&shard->totalEntries, tot, __ATOMIC_RELAXED);
+   if(unq)
+      __atomic_add_fetch(&shard->uniqueEntries, unq, __ATOMIC_RELAXED);
+}
+
+HashNode* shardNode(Shard *shard, void *data, unsigned hash)
+{
+   HashNode *node;
+
+   pthread_mutex_lock(&shard->lock);
+   node = allocNode(&shard->pool);
+   pthread_mutex_unlock(&shard->lock);
+   node->entry.data = data;
+   node->entry.frequency = 1;
+   node->hash = hash;
+   return node;
+}
+
+void shardRelease(Shard *shard, HashNode *node)
+{
+   pthread_mutex_lock(&shard->lock);
+   releaseNode(&shard->pool, node);
+   pthread_mutex_unlock(&shard->lock);
+}
+
+unsigned bucketCount(ConcurrentTable *ct, Buckets *b)
+{
+   return ct->base.sizes[b->sizeIndex];
+}
+
+Buckets* allocBuckets(ConcurrentTable *ct, unsigned sizeIndex)
+{
+   Buckets *b = calloc(1, sizeof(Buckets) +
+      (ct->base.sizes[sizeIndex] - 1) * sizeof(HashNode*));
+   if(b == NULL)
+      mallocError();
+   b->sizeIndex = sizeIndex;
+   return b;
+}
+
+HashNode** bucketOf(ConcurrentTable *ct, Buckets *b, unsigned hash)
+{
+   return &b->heads[reduceHash(&ct->base, hash, b->sizeIndex)];
+}
+
+/* Searches a chain from node up to (not including) stop. */
+HashNode* searchChain(HashTable *ht, HashNode *node, HashNode *stop,
+   void *data, unsigned hash)
+{
+   for(; node != stop; node = LOAD(&node->next))
+      if(node->hash == hash && dataCompare(ht, data, node->entry.data) == 0)
+         return node;
+   return NULL;
+}
+
+/* Never waits for a rehash before searching: nodes are never freed and a
+ * half relinked chain cannot loop, so a hit is returned at once. Only a
+ * miss that overlapped a rehash (the counter was odd or has moved) is
+ * retried, yielding to the rehashing thread while it is still running.
+ */
+HashNode* concurrentFind(ConcurrentTable *ct, void *data, unsigned hash)
+{
+   HashNode *node;
+   unsigned seq;
+
+   for(;;)
+   {
+      seq = LOAD(&ct->seq);
+      node = searchChain(&ct->base, LOAD(bucketOf(ct, LOAD(&ct->buckets),
+         hash)), NULL, data, hash);
+      if(node != NULL)
+         return node;
+      __atomic_thread_fence(__ATOMIC_ACQUIRE);
+      if(!(seq & 1) && __atomic_load_n(&ct->seq, __ATOMIC_RELAXED) == seq)
+         return NULL;
+      if(__atomic_load_n(&ct->seq, __ATOMIC_RELAXED) & 1)
+         sched_yield();
+   }
+}
+
+unsigned hitNode(ConcurrentTable *ct, HashNode *node)
+{
+   shardCount(localShard(ct), 1, 0);
+   return __atomic_add_fetch(&node->entry.frequency, 1, __ATOMIC_RELAXED);
+}
+
+/* Called with the resize lock held shared, so the bucket array is stable
+ * but other threads may be pushing onto the same chain.
+ */
+unsigned insertNode(ConcurrentTable *ct, void *data, unsigned hash)
+{
+   HashNode **head = bucketOf(ct, LOAD(&ct->buckets), hash);
+   HashNode *first = LOAD(head), *stop = NULL, *found, *node = NULL;
+   Shard *shard = localShard(ct);
+
+   for(;;)
+   {
+      if((found = searchChain(&ct->base, first, stop, data, hash)) != NULL)
+      {
+         if(node != NULL)
+            shardRelease(shard, node);
+         return hitNode(ct, found);
+      }
+      if(node == NULL)
+         node = shardNode(shard, data, hash);
+      node->next = first;
+      if(__atomic_compare_exchange_n(head, &first, node, 0, __ATOMIC_RELEASE,
+         __ATOMIC_ACQUIRE))
+         break;
+      stop = node->next;
+   }
+   shardCount(shard, 1, 1);
+   if(ct->base.dataSize != NULL)
+      __atomic_add_fetch(&shard->dataBytes, ownedDataSize(&ct->base, data),
+         __ATOMIC_RELAXED);
+   return 1;
+}
+
+void relinkNode(ConcurrentTable *ct, Buckets *b, HashNode **tails,
+   HashNode *node)
+{
+   unsigned i = reduceHash(&ct->base, node->hash, b->sizeIndex);
+
+   __atomic_store_n(&node->next, NULL, __ATOMIC_RELAXED);
+   if(tails[i])
+      __atomic_store_n(&tails[i]->next, node, __ATOMIC_RELAXED);
+   else
+      b->heads[i] = node;
+   tails[i] = node;
+}
+
+/* Called with the resize lock held exclusively. */
+void concurrentRehash(ConcurrentTable *ct)
+{
+   Buckets *old = ct->buckets, *b = allocBuckets(ct, old->sizeIndex + 1);
+   HashNode **tails = calloc(bucketCount(ct, b), sizeof(HashNode*));
+   HashNode *node, *next;
+   unsigned i;
+
+   if(tails == NULL)
+      mallocError();
+
+   __atomic_store_n(&ct->seq, ct->seq + 1, __ATOMIC_RELAXED);
+   __atomic_thread_fence(__ATOMIC_RELEASE);
+   for(i = 0; i < bucketCount(ct, old); i++)
+      for(node = old->heads[i]; node; node = next)
+      {
+         next = node->next;
+         relinkNode(ct, b, tails, node);
+      }
+   b->retired = old;
+   STORE(&ct->buckets, b);
+   __atomic_store_n(&ct->base.sizeIndex, b->sizeIndex, __ATOMIC_RELAXED);
+   STORE(&ct->seq, ct->seq + 1);
+   free(tails);
+}
+
+unsigned concurrentAdd(HashTable *ht, void *data, unsigned hash)
+{
+   ConcurrentTable *ct = (ConcurrentTable*)ht;
+   HashNode *node;
+   unsigned freq;
+   int grow;
+
+   if((node = concurrentFind(ct, data, hash)) != NULL)
+      return hitNode(ct, node);
+
+   pthread_rwlock_rdlock(&ct->resizeLock);
+   freq = insertNode(ct, data, hash);
+   grow = freq == 1 && needsRehash(ht);
+   pthread_rwlock_unlock(&ct->resizeLock);
+
+   if(grow)
+   {
+      pthread_rwlock_wrlock(&ct->resizeLock);
+      if(needsRehash(ht))
+         concurrentRehash(ct);
+      pthread_rwlock_unlock(&ct->resizeLock);
+   }
+   return freq;
+}
+
+HTEntry concurrentLookUp(HashTable *ht, void *data, unsigned hash)
+{
+   HashNode *node = concurrentFind((ConcurrentTable*)ht, data, hash);
+   HTEntry entry;
+
+   entry.data = NULL;
+   entry.frequency = 0;
+   if(node != NULL)
+   {
+      entry.data = node->entry.data;
+      entry.frequency = __atomic_load_n(&node->entry.frequency,
+         __ATOMIC_RELAXED);
+   }
+   return entry;
+}
+
+void concurrentPrefetch(HashTable *ht, unsigned hash, int depth)
+{
+   ConcurrentTable *ct = (ConcurrentTable*)ht;
+   HashNode **head = bucketOf(ct, LOAD(&ct->buckets), hash);
+
+   if(depth == 0)
+      HT_PREFETCH(head);
+   else
+      HT_PREFETCH(LOAD(head));
+}
+
+/* The walks below hold the resize lock exclusively so no node is added
+ * or relinked under them.
+ */
+void concurrentToArray(HashTable *ht, HTEntry *entryArr, unsigned size)
+{
+   ConcurrentTable *ct = (ConcurrentTable*)ht;
+   HashNode *node;
+   unsigned i, j = 0;
+
+   pthread_rwlock_wrlock(&ct->resizeLock);
+   for(i = 0; j < size && i < bucketCount(ct, ct->buckets); i++)
+      for(node = ct->buckets->heads[i]; j < size && node; node = node->next)
+      {
+         entryArr[j].data = node->entry.data;
+         entryArr[j++].frequency = __atomic_load_n(&node->entry.frequency,
+            __ATOMIC_RELAXED);
+      }
+   pthread_rwlock_unlock(&ct->resizeLock);
+}
+
+/* Only valid while no adds are running, see htIterBegin. */
+HTEntry* concurrentIterNext(HashTable *ht, HTIter *iter, unsigned *hash)
+{
+   Buckets *b = ((ConcurrentTable*)ht)->buckets;
+   HashNode *node = iter->position;
+   unsigned size = bucketCount((ConcurrentTable*)ht, b);
+
+   if(node != NULL)
+      node = node->next;
+   else if(iter->bucket < size)
+      node = b->heads[iter->bucket];
+   else
+      iter->bucket = size;
+   while(node == NULL && iter->bucket + 1 < size)
+      node = b->heads[++iter->bucket];
+
+   if((iter->position = node) == NULL)
+   {
+      iter->bucket = size;
+      return NULL;
+   }
+   if(hash != NULL)
+      *hash = node->hash;
+   return &node->entry;
+}
+
+unsigned concurrentProbeLengths(HashTable *ht, unsigned *counts,
+   unsigned numCounts)
+{
+   ConcurrentTable *ct = (ConcurrentTable*)ht;
+   HashNode *node;
+   unsigned i, probes, maxProbes = 0;
+
+   pthread_rwlock_wrlock(&ct->resizeLock);
+   for(i = 0; i < bucketCount(ct, ct->buckets); i++)
+   {
+      probes = 0;
+      for(node = ct->buckets->heads[i]; node; node = node->next)
+      {
+         probes++;
+         if(counts != NULL)
+            countProbe(counts, numCounts, probes);
+      }
+      if(probes > maxProbes)
+         maxProbes = probes;
+   }
+   pthread_rwlock_unlock(&ct->resizeLock);
+   return maxProbes;
+}
+
+double concurrentMissProbes(HashTable *ht)
+{
+   ConcurrentTable *ct = (ConcurrentTable*)ht;
+   unsigned i, entries = 0, size;
+   HashNode *node;
+
+   pthread_rwlock_wrlock(&ct->resizeLock);
+   size = bucketCount(ct, ct->buckets);
+   for(i = 0; i < size; i++)
+      for(node = ct->buckets->heads[i]; node; node = node->next)
+         entries++;
+   pthread_rwlock_unlock(&ct->resizeLock);
+   return (double)entries / size;
+}
+
+HTMetrics concurrentMetrics(HashTable *ht)
+{
+   ConcurrentTable *ct = (ConcurrentTable*)ht;
+   HTMetrics metrics;
+   unsigned i, entries = 0;
+   HashNode *node;
+
+   metrics.numberOfChains = 0;
+   metrics.maxChainLength = concurrentProbeLengths(ht, NULL, 0);
+
+   pthread_rwlock_wrlock(&ct->resizeLock);
+   for(i = 0; i < bucketCount(ct, ct->buckets); i++)
+   {
+      if(ct->buckets->heads[i] != NULL)
+         metrics.numberOfChains++;
+      for(node = ct->buckets->heads[i]; node; node = node->next)
+         entries++;
+   }
+   pthread_rwlock_unlock(&ct->resizeLock);
+
+   metrics.avgChainLength = ((float)entries /
+      (float)(metrics.numberOfChains));
+   return metrics;
+}
+
+unsigned concurrentCount(HashTable *ht, int unique)
+{
+   Shard *shards = ((ConcurrentTable*)ht)->shards;
+   unsigned i, sum = 0;
+
+   for(i = 0; i < NUM_SHARDS; i++)
+      sum += __atomic_load_n(unique ? &shards[i].uniqueEntries :
+         &shards[i].totalEntries, __ATOMIC_RELAXED);
+   return sum;
+}
+
+/* Every bucket array ever published is still allocated, see the top. The
+ * pools are read under their shard locks.
+ */
+void concurrentMemoryUsage(HashTable *ht, HTMemoryUsage *usage,
+   unsigned *allocations)
+{
+   ConcurrentTable *ct = (ConcurrentTable*)ht;
+   Buckets *b;
+   unsigned i;
+
+   usage->tableBytes += sizeof(ConcurrentTable);
+   (*allocations)++;
+   for(b = LOAD(&ct->buckets); b != NULL; b = b->retired)
+   {
+      usage->bucketBytes += sizeof(Buckets) +
+         (bucketCount(ct, b) - 1) * sizeof(HashNode*);
+      (*allocations)++;
+   }
+   for(i = 0; i < NUM_SHARDS; i++)
+   {
+      pthread_mutex_lock(&ct->shards[i].lock);
+      usage->nodeBytes += ct->shards[i].pool.bytes;
+      *allocations += ct->shards[i].pool.numSlabs;
+      pthread_mutex_unlock(&ct->shards[i].lock);
+      usage->dataBytes += __atomic_load_n(&ct->shards[i].dataBytes,
+         __ATOMIC_RELAXED);
+   }
+}
+
+void concurrentDestroy(HashTable *ht)
+{
+   ConcurrentTable *ct = (ConcurrentTable*)ht;
+   Buckets *b, *retired;
+   unsigned i;
+
+   for(i = 0; i < NUM_SHARDS; i++)
+   {
+      destroyPool(&ct->shards[i].pool, ht);
+      pthread_mutex_destroy(&ct->shards[i].lock);
+   }
+   for(b = ct->buckets; b != NULL; b = retired)
+   {
+      retired = b->retired;
+      free(b);
+   }
+   pthread_rwlock_destroy(&ct->resizeLock);
+   freeTable(ht);
+}
+
+const HTEngine concurrentEngine = {
+   concurrentAdd,
+   concurrentLookUp,
+   NULL,
+   NULL,
+   concurrentPrefetch,
+   concurrentToArray,
+   concurrentIterNext,
+   concurrentMetrics,
+   concurrentProbeLengths,
+   concurrentMissProbes,
+   concurrentMemoryUsage,
+   concurrentCount,
+   concurrentDestroy
+};
+
+/* Inserts hold the resize lock shared, and glibc's default rwlock lets new
+ * readers in while a writer waits, so under a steady stream of inserts a
+ * rehash could wait forever while the chains keep growing. Waiting writers
+ * go first instead. No thread takes the lock shared twice, as the
+ * nonrecursive kind requires.
+ */
+void initResizeLock(ConcurrentTable *ct)
+{
+   pthread_rwlockattr_t attr;
+
+   if(pthread_rwlockattr_init(&attr) != 0)
+      mallocError();
+#ifdef __GLIBC__
+   pthread_rwlockattr_setkind_np(&attr,
+      PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+#endif
+   if(pthread_rwlock_init(&ct->resizeLock, &attr) != 0)
+      mallocError();
+   pthread_rwlockattr_destroy(&attr);
+}
+
+HashTable* concurrentCreate(HTFunctions *functions, unsigned sizes[],
+   int numSizes, float rehashLoadFactor, const HTOptions *options)
+{
+   ConcurrentTable *ct = malloc(sizeof(ConcurrentTable));
+   unsigned i;
+
+   if(ct == NULL)
+      mallocError();
+
+   initTable(&ct->base, functions, sizes, numSizes, rehashLoadFactor,
+      options);
+   ct->base.engine = &concurrentEngine;
+   assert(ct->base.bloom == NULL);
+   ct->buckets = allocBuckets(ct, 0);
+   ct->seq = 0;
+   initResizeLock(ct);
+   for(i = 0; i < NUM_SHARDS; i++)
+   {
+      ct->shards[i].totalEntries = 0;
+      ct->shards[i].uniqueEntries = 0;
+      ct->shards[i].dataBytes = 0;
+      initPool(&ct->shards[i].pool, sizeof(HashNode));
+      if(pthread_mutex_init(&ct->shards[i].lock, NULL) != 0)
+         mallocError();
+   }
+   return &ct->base;
+}
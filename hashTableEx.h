@@ -0,0 +1,751 @@
+/* Extended hash table interface. hashTable.h is the fixed, provided interface
+ * and must not be modified, so every feature beyond it is declared here. All
+ * functions declared in hashTable.h work on tables created by htCreateEx.
+ */
+#ifndef HASHTABLEEX_H
+#define HASHTABLEEX_H
+
+#include "hashTable.h"
+#include <stddef.h>
+
+/* The storage engines available behind the hash table interface.
+ *
+ *    HT_ENGINE_CHAIN: Separate chaining, the engine used by htCreate.
+ *
+ *    HT_ENGINE_ROBIN_HOOD: Open addressing with Robin Hood linear probing.
+ *       Entries live inline in a flat array of slots together with their
+ *       cached hash, so a lookup touches consecutive memory instead of
+ *       chasing chain pointers. Because there are no chains, htMetrics
+ *       reports probe lengths instead (see htCreateEx below).
+ *
+ *    HT_ENGINE_SWISS: Open addressing in the style of SwissTable. A one byte
+ *       control tag per slot, laid out in groups of 16, holds 7 bits of the
+ *       hash so a lookup compares a whole group of tags at once (with SSE2
+ *       when available) and only calls FNCompare on tag matches. Misses
+ *       usually touch a single cache line of tags. Probe lengths are
+ *       counted in groups rather than slots.
+ *
+ *    HT_ENGINE_CONCURRENT: Separate chaining that any number of threads may
+ *       use at once without external locking. htLookUp takes no lock, htAdd
+ *       increments the frequency of an existing entry atomically and inserts
+ *       a new one with a compare and swap on its bucket, and only a rehash
+ *       excludes other adds for its duration. The entry counts are kept per
+ *       CPU and summed by htTotalEntries and htUniqueEntries. See the notes
+ *       of htCreateEx. Requires linking with -pthread.
+ */
+typedef enum
+{
+   HT_ENGINE_CHAIN,
+   HT_ENGINE_ROBIN_HOOD,
+   HT_ENGINE_SWISS,
+   HT_ENGINE_CONCURRENT
+} HTEngineType;
+
+/* How a hash value is reduced to a bucket (or slot) index.
+ *
+ *    HT_INDEX_MODULO: hash % size, the behaviour of htCreate.
+ *
+ *    HT_INDEX_RECIPROCAL: The same index as HT_INDEX_MODULO computed with
+ *       a fixed-point reciprocal precomputed for every size (two multiplies
+ *       instead of a hardware divide).
+ *
+ *    HT_INDEX_MULTIPLY_SHIFT: Lemire's range reduction, the high 32 bits of
+ *       hash * size. A single multiply, but it uses the high bits of the
+ *       hash so FNHash must mix well into them.
+ *
+ *    HT_INDEX_FIBONACCI: Every size must be a power of two (asserted). The
+ *       hash is multiplied by 2^32 divided by the golden ratio and the top
+ *       bits are used, which also mixes weak hashes.
+ */
+typedef enum
+{
+   HT_INDEX_MODULO,
+   HT_INDEX_RECIPROCAL,
+   HT_INDEX_MULTIPLY_SHIFT,
+   HT_INDEX_FIBONACCI
+} HTIndexMode;
+
+/* The order the chaining engine keeps the entries of a chain in. A search
+ * stops at the first match either way.
+ *
+ *    HT_CHAIN_INSERTION: New entries are appended to the chain and entries
+ *       never move within it, the behaviour of htCreate.
+ *
+ *    HT_CHAIN_MOVE_TO_FRONT: An entry found by htAdd or htLookUp is moved
+ *       to the head of its chain. Adapts quickly to bursts.
+ *
+ *    HT_CHAIN_BY_FREQUENCY: An entry whose frequency is incremented by htAdd
+ *       moves ahead of every entry with a lower frequency, so the most
+ *       frequent entries of skewed (Zipfian) data are found first.
+ */
+typedef enum
+{
+   HT_CHAIN_INSERTION,
+   HT_CHAIN_MOVE_TO_FRONT,
+   HT_CHAIN_BY_FREQUENCY
+} HTChainOrder;
+
+/* Returns the number of bytes the data and anything it owns occupy on the
+ * heap, as accounted by htMemoryUsage (see dataSize in HTOptions).
+ */
+typedef size_t (*FNSize)(const void *data);
+
+/* Creation options for htCreateEx. Always initialize the structure with
+ * htDefaultOptions before setting any fields so that options added in the
+ * future get sensible defaults.
+ *
+ *    engine: The storage engine, HT_ENGINE_CHAIN by default.
+ *
+ *    incrementalRehash: Chaining engine only. When 0 (the default) htAdd
+ *       moves every entry to the new bucket array the moment a rehash is
+ *       needed. Otherwise the old and new bucket arrays are kept side by
+ *       side and every htAdd and htLookUp migrates this many old buckets
+ *       (plus the bucket of the data it is working on) until the old array
+ *       is drained, which bounds the latency of any single call. htCapacity
+ *       reports the new size as soon as the rehash starts.
+ *
+ *    rehashThreads: Chaining engine only, ignored when incrementalRehash is
+ *       set. When greater than 1 a rehash is partitioned by destination
+ *       bucket range and spread across this many threads (the calling
+ *       thread being one of them). Worth it for tables of millions of
+ *       entries. Requires linking with -pthread. The default is 1.
+ *
+ *    indexMode: How hash values are reduced to indexes, HT_INDEX_MODULO by
+ *       default. Applies to every engine.
+ *
+ *    chainOrder: Chaining engine only. The chain order policy,
+ *       HT_CHAIN_INSERTION by default.
+ *
+ *    shrinkLoadFactor: When greater than 0, an htRemove or htDecrement that
+ *       removes an entry and leaves the load factor below this value moves
+ *       the table back to the previous size in sizes[], provided the entries
+ *       stay below rehashLoadFactor there. Must be less than
+ *       rehashLoadFactor (asserted). The default, 0, never shrinks.
+ *
+ *    bloomFalsePositiveRate: When greater than 0, a blocked Bloom filter
+ *       with this false positive rate (e.g. 0.01) is kept in front of the
+ *       table so most htLookUp misses cost a single cache line instead of a
+ *       bucket search. It is maintained by htAdd and rebuilt from the cached
+ *       hashes, without calling FNHash, as the table grows (or shrinks
+ *       well below its design). Removed entries linger in it until then,
+ *       which only costs false positives. Must be below 1 (asserted). Not
+ *       supported by HT_ENGINE_CONCURRENT (asserted). The default, 0, has no
+ *       filter. htMetricsEx reports its size.
+ *
+ *    inlineKeyBytes: Chaining engine only (asserted). When greater than 0
+ *       the data is a NUL terminated string and the table keeps its own
+ *       copy of every key: a key of up to inlineKeyBytes bytes, its NUL
+ *       included, is stored inside its node, a longer one in a separate
+ *       allocation. A lookup then compares against the bytes of the node it
+ *       has already loaded, and short keys cost no allocation at all. The
+ *       value is rounded up to a multiple of the pointer size, and each node
+ *       grows by that much whether its key fits or not. In this mode:
+ *          - htAdd never takes over the data: the caller keeps it, new key
+ *            or not, and may reuse or free it right away.
+ *          - The data of a returned HTEntry points into the table and is
+ *            valid until the entry is removed or the table destroyed.
+ *          - htRemove returns its data argument rather than the stored
+ *            copy, which the table frees, as does htDecrement.
+ *          - FNDestroy must be NULL (asserted) and FNHash and FNCompare
+ *            receive strings, the caller's or the table's copies.
+ *          - htMerge and htMergeAll require equal inlineKeyBytes
+ *            (asserted).
+ *       The default, 0, stores the caller's data as htCreate does.
+ *
+ *    dataSize: When not NULL, called once for every data item the table
+ *       takes over (a new key added by htAdd, htAddBatch or htFindOrInsert)
+ *       so htMemoryUsage can report the bytes of user data without walking
+ *       the table. Ignored with inlineKeyBytes and by htAddString, whose
+ *       keys the table copies and accounts itself. htMerge and htMergeAll
+ *       require equal dataSize (asserted). The default, NULL, reports no
+ *       user data.
+ */
+typedef struct
+{
+   HTEngineType engine;
+   unsigned incrementalRehash;
+   unsigned rehashThreads;
+   HTIndexMode indexMode;
+   HTChainOrder chainOrder;
+   float shrinkLoadFactor;
+   float bloomFalsePositiveRate;
+   unsigned inlineKeyBytes;
+   FNSize dataSize;
+} HTOptions;
+
+/* Description: Initializes the options to the behaviour of htCreate.
+ *
+ * Parameters:
+ *    options: The options to initialize.
+ *
+ * Return: None
+ */
+void htDefaultOptions(HTOptions *options);
+
+/* Description: Creates a new hash table exactly like htCreate but with the
+ *    specified options.
+ *
+ * Notes:
+ *   1. All of the asserts and notes of htCreate apply.
+ *   2. Open addressing engines hold at most one entry per slot. When every
+ *      slot is in use they rehash to the next size even if the load factor
+ *      is 1.0, and when there is no next size htAdd reports the failure and
+ *      exits. Choose sizes and a load factor well below 1.0 accordingly.
+ *   3. For open addressing engines htMetrics reports the number of occupied
+ *      slots as numberOfChains, the longest probe sequence of any entry as
+ *      maxChainLength and the average probe sequence length of the entries
+ *      as avgChainLength. htProbeLengths reports the full distribution.
+ *   4. With HT_ENGINE_CONCURRENT htAdd, htAddBatch, htLookUp, htLookUpBatch,
+ *      htTotalEntries and htUniqueEntries may be called from any number of
+ *      threads at once. htToArray, htMetrics and htProbeLengths may run
+ *      alongside them too and see a consistent set of entries, though
+ *      frequencies can still be rising. htCapacity is only exact while no
+ *      htAdd is running, and htDestroy must not overlap any other call. The
+ *      incrementalRehash, rehashThreads and chainOrder options are ignored,
+ *      and htRemove and htDecrement are not supported (asserted).
+ *      Entries are never moved or freed before htDestroy, so data seen in a
+ *      returned HTEntry stays valid.
+ *
+ * Parameters:
+ *    functions, sizes, numSizes, rehashLoadFactor: As for htCreate.
+ *    options: The creation options, NULL means the defaults.
+ *
+ * Return: A pointer to an anonymous structure representing a hash table
+ *         that is used with all of the other hash table functions.
+ */
+void* htCreateEx(
+   HTFunctions *functions,
+   unsigned sizes[],
+   int numSizes,
+   float rehashLoadFactor,
+   const HTOptions *options
+);
+
+/* The heap memory of a hash table in bytes, see htMemoryUsage.
+ *
+ *    tableBytes: The table structure, its sizes, functions and engine
+ *       state, and the Bloom filter if there is one.
+ *
+ *    bucketBytes: The bucket array (both while an incremental rehash is in
+ *       progress), or the slots and control bytes of an open addressing
+ *       engine.
+ *
+ *    nodeBytes: The chain nodes, counting every node the node pool has
+ *       allocated whether it holds an entry or waits on the free list.
+ *       With inlineKeyBytes this includes the keys stored in the nodes.
+ *
+ *    entryBytes: unique * sizeof(HTEntry), the part of bucketBytes and
+ *       nodeBytes that holds the data pointers and frequencies themselves.
+ *       Not added to totalBytes again.
+ *
+ *    keyBytes: Keys the table copied itself: the chunks of the htAddString
+ *       arena and, with inlineKeyBytes, keys too long for their node.
+ *
+ *    dataBytes: The sum of FNSize over the data the table owns, 0 when
+ *       dataSize was not set.
+ *
+ *    slackBytes: An estimate of the allocator's own overhead: a fixed
+ *       number of bytes of header and rounding per block the table has
+ *       allocated. Not part of any other field.
+ *
+ *    totalBytes: tableBytes + bucketBytes + nodeBytes + keyBytes +
+ *       dataBytes + slackBytes.
+ */
+typedef struct
+{
+   size_t tableBytes;
+   size_t bucketBytes;
+   size_t nodeBytes;
+   size_t entryBytes;
+   size_t keyBytes;
+   size_t dataBytes;
+   size_t slackBytes;
+   size_t totalBytes;
+} HTMemoryUsage;
+
+/* Metrics beyond those of htMetrics. The distribution metrics are about
+ * home buckets, the bucket each entry's hash maps to (its chain for
+ * HT_ENGINE_CHAIN and HT_ENGINE_CONCURRENT, the slot its probing starts
+ * from otherwise), so they judge FNHash and sizes independent of how the
+ * engine resolves collisions.
+ *
+ *    basic: What htMetrics reports.
+ *
+ *    filterBytes: The size of the Bloom filter in bytes, 0 without one (see
+ *       bloomFalsePositiveRate in HTOptions).
+ *
+ *    histogram: histogram[i] is the number of home buckets with i entries,
+ *       for i from 0 to histogramLength - 1 (the largest load). Allocated
+ *       by htMetricsEx, the caller must free it.
+ *
+ *    emptyBucketRatio: The fraction of home buckets with no entries. About
+ *       e^-(unique / capacity) for a good FNHash.
+ *
+ *    loadVariance: The variance of the number of entries per home bucket.
+ *       For a good FNHash it is close to the mean, unique / capacity.
+ *
+ *    chiSquare, degreesOfFreedom: Pearson's chi-square statistic of the
+ *       histogram against the Poisson distribution a random FNHash would
+ *       give, with the tail pooled so each class expects at least 5
+ *       buckets. chiSquare / degreesOfFreedom near 1 is as good as random,
+ *       well above 2 means FNHash (or a size sharing factors with its
+ *       patterns) clusters. degreesOfFreedom is 0 when there are too few
+ *       buckets to tell.
+ *
+ *    hitProbes: The average number of chain nodes, slots or (for
+ *       HT_ENGINE_SWISS) groups a successful htLookUp visits, over all
+ *       entries.
+ *
+ *    missProbes: The same for an unsuccessful htLookUp, averaged over all
+ *       home buckets.
+ *
+ *    memory: What htMemoryUsage reports.
+ */
+typedef struct
+{
+   HTMetrics basic;
+   size_t filterBytes;
+   unsigned *histogram;
+   unsigned histogramLength;
+   double emptyBucketRatio;
+   double loadVariance;
+   double chiSquare;
+   unsigned degreesOfFreedom;
+   double hitProbes;
+   double missProbes;
+   HTMemoryUsage memory;
+} HTMetricsEx;
+
+/* Description: Reports htMetrics and the additional metrics of
+ *    HTMetricsEx.
+ *
+ * Notes:
+ *    1. O(N) like htMetrics, intended for performance tuning only.
+ *    2. The caller must free metrics->histogram.
+ *    3. With HT_ENGINE_CONCURRENT no other thread may add entries during the
+ *       call.
+ *
+ * Parameters:
+ *    hashTable: A pointer returned by htCreate or htCreateEx.
+ *    metrics: The metrics to fill in.
+ *
+ * Return: None
+ */
+void htMetricsEx(void *hashTable, HTMetricsEx *metrics);
+
+/* Description: Reports how many bytes of heap memory the table occupies
+ *    and what for (see HTMemoryUsage).
+ *
+ * Notes:
+ *    1. O(1): every figure is kept up to date as the table changes, so
+ *       unlike htMetricsEx it may be called as often as needed.
+ *    2. Memory the table has allocated but not yet used (free nodes, the
+ *       rest of an arena chunk, empty slots) counts as used.
+ *    3. With HT_ENGINE_CONCURRENT dataBytes may lag behind adds running on
+ *       other threads.
+ *
+ * Parameters:
+ *    hashTable: A pointer returned by htCreate, htCreateEx or
+ *       htLoadMapped.
+ *
+ * Return: The memory usage of the table.
+ */
+HTMemoryUsage htMemoryUsage(void *hashTable);
+
+/* Description: Reports the distribution of the number of slots (or chain
+ *    nodes) a successful htLookUp visits for the entries in the table.
+ *
+ * Notes:
+ *    1. O(N) like htMetrics, intended for performance tuning only.
+ *    2. counts[i] is set to the number of entries found after i + 1 probes.
+ *       Entries needing more than numCounts probes are added to the last
+ *       element.
+ *
+ * Parameters:
+ *    hashTable: A pointer returned by htCreate or htCreateEx.
+ *    counts: Output array of numCounts elements.
+ *    numCounts: The number of elements in counts, must be at least 1.
+ *
+ * Return: The longest probe sequence of any entry, 0 if the table is empty.
+ */
+unsigned htProbeLengths(void *hashTable, unsigned *counts, unsigned numCounts);
+
+/* Description: Adds every data item in the array, exactly as calling htAdd
+ *    on each in order would, but overlaps their cache misses: the data is
+ *    hashed in blocks, the buckets and first nodes of a whole block are
+ *    prefetched and only then are the adds resolved.
+ *
+ * Notes:
+ *    1. All of the notes of htAdd apply to each data item, including that
+ *       the caller frees duplicates (those with a frequency above 1).
+ *    2. The function asserts (man 3 assert) if any data item is NULL.
+ *
+ * Parameters:
+ *    hashTable: A pointer returned by htCreate or htCreateEx.
+ *    data: The data to add.
+ *    count: The number of items in data.
+ *    freqs: Output array of count elements updated with the value htAdd
+ *       would have returned for each item. May be NULL.
+ *
+ * Return: None
+ */
+void htAddBatch(void *hashTable, void *data[], unsigned count,
+   unsigned freqs[]);
+
+/* Description: Adds a string that the caller keeps, copying it into the
+ *    table only if it is new. The copies are packed into large chunks owned
+ *    by the table (an arena) that htDestroy frees all at once, so adding a
+ *    token from a read buffer costs no allocation per key and nothing for
+ *    the caller to free.
+ *
+ * Notes:
+ *    1. FNHash and FNCompare receive the NUL terminated copy, so they must
+ *       take strings. s itself need not be NUL terminated.
+ *    2. A table is filled either by htAddString or by htAdd and
+ *       htAddBatch, never both (asserted), since the arena owns every key:
+ *       FNDestroy is not called and keys are not freed one by one.
+ *    3. The data of a returned HTEntry, including what htRemove returns,
+ *       points into the arena and stays valid until htDestroy. The caller
+ *       must not free it. Removing an entry does not give its bytes back.
+ *    4. Tables filled by htAddString can only be merged with each other
+ *       (asserted). The merged table takes over the arenas.
+ *    5. With inlineKeyBytes (see HTOptions) the table keeps its own copies
+ *       in the nodes instead, and the arena only holds the key while it is
+ *       added; htAdd may then be used as well.
+ *    6. Not supported by HT_ENGINE_CONCURRENT (asserted).
+ *
+ * Parameters:
+ *    hashTable: A pointer returned by htCreate or htCreateEx.
+ *    s: The bytes of the string, they still belong to the caller.
+ *    len: The number of bytes in s, not counting any NUL terminator.
+ *
+ * Return: The frequency of the string after it was added.
+ */
+unsigned htAddString(void *hashTable, const char *s, size_t len);
+
+/* Called by htFindOrInsert with its probe and context when the probe is not
+ * in the table. Returns the data to store: a new heap object, which the
+ * table then owns like data passed to htAdd, equal to the probe per
+ * FNCompare and with the same FNHash. Must not return NULL or use the
+ * table.
+ */
+typedef void* (*FNMaterialize)(const void *probe, void *context);
+
+/* Description: Adds the data equal to a probe without the caller having to
+ *    allocate it first. The probe, which may live on the stack, is hashed
+ *    and compared exactly as htAdd would its data; only when it is not in
+ *    the table is make called to produce the data that is stored. For
+ *    duplicate-heavy input this saves an allocation and a free per
+ *    duplicate.
+ *
+ * Notes:
+ *    1. The probe still belongs to the caller and is never stored.
+ *    2. Counts, growth and chain order are exactly those of htAdd.
+ *    3. Not supported by HT_ENGINE_CONCURRENT, with inlineKeyBytes or on a
+ *       table filled by htAddString (asserted), which copy keys themselves.
+ *    4. The function asserts (man 3 assert) if probe or make is NULL.
+ *
+ * Parameters:
+ *    hashTable: A pointer returned by htCreate or htCreateEx.
+ *    probe: The data to add.
+ *    make: Makes the data to store from the probe.
+ *    context: Passed through to make, may be NULL.
+ *
+ * Return: The frequency of the entry after the add and its stored data,
+ *         the object make returned if it was new.
+ */
+HTEntry htFindOrInsert(void *hashTable, const void *probe, FNMaterialize make,
+   void *context);
+
+/* Description: Looks up every data item in the array, exactly as calling
+ *    htLookUp on each would, overlapping their cache misses like htAddBatch.
+ *
+ * Notes:
+ *    1. The function asserts (man 3 assert) if any data item is NULL.
+ *
+ * Parameters:
+ *    hashTable: A pointer returned by htCreate or htCreateEx.
+ *    data: The data to look for.
+ *    count: The number of items in data.
+ *    entries: Output array of count elements updated with the HTEntry
+ *       htLookUp would have returned for each item.
+ *
+ * Return: None
+ */
+void htLookUpBatch(void *hashTable, void *data[], unsigned count,
+   HTEntry entries[]);
+
+/* A cursor over the entries of a hash table, see htIterBegin. Treat every
+ * field as read only.
+ *
+ *    bucket: The bucket (or slot) of the entry last returned by htIterNext,
+ *       htCapacity (or more) once the cursor is exhausted.
+ *
+ *    entry: Tables from htLoadMapped do not store their entries as
+ *       HTEntry, so htIterNext returns a copy kept here instead.
+ */
+typedef struct
+{
+   void *hashTable;
+   unsigned bucket;
+   void *position;
+   HTEntry entry;
+} HTIter;
+
+/* Called by htForEach with each entry and the context passed to it. Return
+ * nonzero to stop the iteration.
+ */
+typedef int (*FNVisit)(HTEntry *entry, void *context);
+
+/* Description: Starts a cursor over the entries of the hash table at the
+ *    specified bucket. Nothing is allocated and nothing needs releasing.
+ *
+ * Notes:
+ *    1. Entries come in the order of htToArray, bucket by bucket, so a
+ *       cursor started at bucket 0 visits every entry exactly once. To
+ *       export in chunks, either keep the cursor between calls or remember
+ *       the bucket after the last entry of a bucket has been returned and
+ *       start a new cursor at the next bucket later.
+ *    2. The cursor is only valid while the table is not modified (htAdd,
+ *       htRemove, htDecrement, htMerge, ...). With HT_ENGINE_CONCURRENT this
+ *       includes adds by other threads.
+ *    3. Buckets are slots for the open addressing engines and number more
+ *       than htCapacity for HT_ENGINE_SWISS.
+ *
+ * Parameters:
+ *    hashTable: A pointer returned by htCreate or htCreateEx.
+ *    iter: The cursor to initialize.
+ *    bucket: The bucket to start at, 0 for all of the entries.
+ *
+ * Return: None
+ */
+void htIterBegin(void *hashTable, HTIter *iter, unsigned bucket);
+
+/* Description: Advances the cursor to the next entry.
+ *
+ * Notes:
+ *    1. The entry returned is the one stored in the hash table, not a copy.
+ *       Neither its data nor its frequency may be modified.
+ *
+ * Parameters:
+ *    iter: A cursor initialized by htIterBegin.
+ *
+ * Return: A pointer to the next entry, NULL when there are no more.
+ */
+HTEntry* htIterNext(HTIter *iter);
+
+/* Description: Calls visit with every entry of the hash table, in the order
+ *    of htToArray, until visit returns nonzero. Nothing is allocated.
+ *
+ * Notes:
+ *    1. The notes of htIterBegin and htIterNext apply.
+ *
+ * Parameters:
+ *    hashTable: A pointer returned by htCreate or htCreateEx.
+ *    visit: The function to call.
+ *    context: Passed through to visit, may be NULL.
+ *
+ * Return: The number of entries visit was called with.
+ */
+unsigned htForEach(void *hashTable, FNVisit visit, void *context);
+
+/* Description: Finds the k most frequent entries without copying or sorting
+ *    the whole table: the entries are streamed through a heap of k, so the
+ *    cost is O(N log k) for a table of N entries.
+ *
+ * Notes:
+ *    1. out is sorted by decreasing frequency. Entries of equal frequency
+ *       are in FNCompare order, which also decides which of them make the
+ *       cut, so the result does not depend on the table layout.
+ *    2. Nothing is allocated, out is used as the heap.
+ *    3. The notes of htIterBegin about modifying the table apply.
+ *
+ * Parameters:
+ *    hashTable: A pointer returned by htCreate or htCreateEx.
+ *    k: The number of entries wanted.
+ *    out: Output array of k elements, may be NULL when k is 0.
+ *
+ * Return: The number of entries stored in out, the lesser of k and
+ *         htUniqueEntries.
+ */
+unsigned htTopK(void *hashTable, unsigned k, HTEntry out[]);
+
+/* Description: Same as htTopK with the buckets split into one range per
+ *    thread. Each thread keeps its own heap of k and the heaps are merged
+ *    at the end.
+ *
+ * Notes:
+ *    1. All of the notes of htTopK apply except that a heap of k entries is
+ *       allocated per thread, and FNCompare may be called from several
+ *       threads at once. Requires linking with -pthread.
+ *
+ * Parameters:
+ *    hashTable: A pointer returned by htCreate or htCreateEx.
+ *    k: The number of entries wanted.
+ *    out: Output array of k elements, may be NULL when k is 0.
+ *    numThreads: The number of threads to use (the calling thread being one
+ *       of them), at least 1.
+ *
+ * Return: The number of entries stored in out.
+ */
+unsigned htTopKParallel(void *hashTable, unsigned k, HTEntry out[],
+   unsigned numThreads);
+
+/* Description: Removes the entry matching the data from the hash table,
+ *    whatever its frequency, and returns the stored data to the caller.
+ *
+ * Notes:
+ *    1. The caller becomes responsible for the returned data, it is not
+ *       passed to FNDestroy or freed by the hash table.
+ *    2. htTotalEntries drops by the frequency the entry had and
+ *       htUniqueEntries by 1.
+ *    3. May shrink the table, see shrinkLoadFactor in HTOptions.
+ *    4. The function asserts (man 3 assert) if data is NULL.
+ *
+ * Parameters:
+ *    hashTable: A pointer returned by htCreate or htCreateEx.
+ *    data: Data equal (per FNCompare) to the entry to remove. It still
+ *       belongs to the caller.
+ *
+ * Return: The data that was stored in the hash table, NULL if there was no
+ *         matching entry.
+ */
+void* htRemove(void *hashTable, void *data);
+
+/* Description: Lowers the frequency of the entry matching the data by one.
+ *    When it reaches 0 the entry is removed and the stored data is passed
+ *    to FNDestroy (if not NULL) and freed, just as htDestroy would.
+ *
+ * Notes:
+ *    1. htTotalEntries drops by 1, and htUniqueEntries by 1 when the entry
+ *       is removed.
+ *    2. May shrink the table, see shrinkLoadFactor in HTOptions.
+ *    3. The function asserts (man 3 assert) if data is NULL.
+ *
+ * Parameters:
+ *    hashTable: A pointer returned by htCreate or htCreateEx.
+ *    data: Data equal (per FNCompare) to the entry to decrement. It still
+ *       belongs to the caller.
+ *
+ * Return: The remaining frequency, 0 if the entry was removed or there was
+ *         no matching entry.
+ */
+unsigned htDecrement(void *hashTable, void *data);
+
+/* Called by htSave for every entry. Writes the bytes representing data to
+ * buffer if they fit in size bytes and returns how many bytes they take
+ * either way; when that is more than size it is called again with a larger
+ * buffer. A table loaded with htLoadMapped passes these bytes to FNHash and
+ * FNCompare as its data, so they must hash and compare like the data
+ * itself: a string with its NUL, or a struct without pointers, fit.
+ */
+typedef size_t (*FNSerialize)(const void *data, void *buffer, size_t size);
+
+/* Description: Writes a snapshot of the hash table to a file that
+ *    htLoadMapped can serve without reading or rebuilding it. The image
+ *    holds a table of bucket offsets, each entry's cached hash and
+ *    frequency, and the serialized data, all located by offsets from the
+ *    start of the file.
+ *
+ * Notes:
+ *    1. Works with every engine. The snapshot has htCapacity buckets and
+ *       an entry's bucket is its hash modulo that, whatever the engine and
+ *       index mode, so for HT_ENGINE_CHAIN with HT_INDEX_MODULO the loaded
+ *       table has the same htToArray order.
+ *    2. The file is only readable on machines with the same byte order.
+ *    3. With HT_ENGINE_CONCURRENT no other thread may add entries during the
+ *       call.
+ *
+ * Parameters:
+ *    hashTable: A pointer returned by htCreate or htCreateEx.
+ *    path: The file to write, replaced if it exists. The image is written
+ *       to a temporary file next to it and renamed over it when complete,
+ *       so a process mapping path sees the old or the new snapshot, never
+ *       a partial one, and a failed save leaves the old one in place.
+ *    serialize: Turns each data item into the bytes stored.
+ *
+ * Return: 0 on success, -1 if the file could not be written (errno tells
+ *         why).
+ */
+int htSave(void *hashTable, const char *path, FNSerialize serialize);
+
+/* Description: Maps a snapshot written by htSave into memory and returns a
+ *    read-only hash table backed directly by the mapping. Nothing is
+ *    copied and only the bucket offsets (4 bytes per bucket) are read up
+ *    front to check them; the entries and keys are loaded as lookups touch
+ *    them, so even a very large snapshot opens quickly.
+ *
+ * Notes:
+ *    1. htLookUp, htLookUpBatch, htToArray, htIterBegin and htIterNext,
+ *       htForEach, htTopK, htTopKParallel, htMetrics, htMetricsEx,
+ *       htProbeLengths, htCapacity, htTotalEntries, htUniqueEntries and
+ *       htDestroy may be used. Any function that adds entries reports that
+ *       the table is read only and exits; htRemove, htDecrement and htMerge
+ *       assert.
+ *    2. The data of a returned HTEntry points at the serialized bytes in
+ *       the mapping, valid until htDestroy, and must not be modified or
+ *       freed.
+ *    3. functions must hash like the FNHash of the saved table, which is
+ *       checked against the first entry (asserted), and compare serialized
+ *       data. FNDestroy is never called.
+ *    4. The header and bucket offsets are checked (every bucket must lie
+ *       within the entries), the entries are trusted: only load files
+ *       written by htSave.
+ *
+ * Parameters:
+ *    path: A file written by htSave.
+ *    functions: The functions to hash and compare the data with.
+ *
+ * Return: A pointer used with the other hash table functions, NULL if the
+ *         file could not be opened or mapped or is not a valid snapshot.
+ */
+void* htLoadMapped(const char *path, HTFunctions *functions);
+
+/* Description: Merges the src hash table into dst as if every entry of src
+ *    had been added to dst as many times as its frequency, then destroys
+ *    src. The nodes of src are relinked into dst rather than copied.
+ *
+ * Notes:
+ *    1. Both tables must use the chaining engine and the same FNHash
+ *       (asserted).
+ *    2. When an entry is in both tables the frequencies are summed and the
+ *       data from dst is kept; the data from src is passed to FNDestroy (if
+ *       not NULL) and freed.
+ *    3. src must not be used after the call, not even with htDestroy.
+ *    4. dst rehashes as it grows, following its own load factor and sizes.
+ *
+ * Parameters:
+ *    dst: The table to merge into, a pointer returned by htCreate or
+ *       htCreateEx.
+ *    src: The table to merge from, a different pointer returned by htCreate
+ *       or htCreateEx.
+ *
+ * Return: None
+ */
+void htMerge(void *dst, void *src);
+
+/* Description: Merges tables[1] .. tables[numTables - 1] into tables[0] like
+ *    calling htMerge for each in turn, but with the work split by bucket
+ *    range across threads. Meant for reducing per-thread shard tables.
+ *
+ * Notes:
+ *    1. All of the notes of htMerge apply to every table merged.
+ *    2. All tables must have been created with the same sizes and index
+ *       mode (asserted). Each is first grown to the largest capacity among
+ *       them, then every thread folds one range of buckets from all of the
+ *       tables at once.
+ *    3. FNDestroy is only called by the calling thread. Requires linking
+ *       with -pthread.
+ *
+ * Parameters:
+ *    tables: The tables, numTables pointers returned by htCreate or
+ *       htCreateEx.
+ *    numTables: The number of tables, at least 1.
+ *    numThreads: The number of threads to use (the calling thread being one
+ *       of them), at least 1.
+ *
+ * Return: None
+ */
+void htMergeAll(void *tables[], unsigned numTables, unsigned numThreads);
+
+#endif
@@ -0,0 +1,481 @@
+#define _POSIX_C_SOURCE 200112L
+#include "hashTable.h"
+#include "hashTablePriv.h"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Snapshots. htSave writes an image laid out as
+ *
+ *    ImageHeader
+ *    uint32_t starts[capacity + 1]   the first entry of every bucket
+ *    ImageEntry entries[unique]      grouped by bucket
+ *    key bytes                       one FNSerialize result per entry
+ *
+ * where the bucket of an entry is its cached hash modulo capacity and every
+ * reference is an offset from the start of the image, so the file can be
+ * mapped anywhere. The entries and keys start on 8 byte boundaries.
+ *
+ * htLoadMapped maps the file and serves it as a read-only engine straight
+ * from the mapping: a lookup reads starts[bucket] and scans that bucket's
+ * entries, comparing cached hashes before calling FNCompare on the key
+ * bytes. Only the bucket offsets are read up front, to check them; the
+ * entries and keys are not read until they are needed.
+ *
+ * htSave writes to a temporary file next to the target and renames it over
+ * the target once it is complete, so a reader maps either the old or the
+ * new image and a failed save leaves the old one in place.
+ */
+#define IMAGE_MAGIC "semiHT\r\n"
+#define IMAGE_VERSION 1
+#define IMAGE_BYTE_ORDER 0x01020304u
+#define KEY_ALIGN 8
+
+typedef struct
+{
+   char magic[8];
+   uint32_t version, byteOrder;
+   uint32_t capacity, uniqueEntries, totalEntries, reserved;
+   uint64_t entriesOffset, keysOffset, size;
+} ImageHeader;
+
+typedef struct
+{
+   uint32_t hash, frequency;
+   uint64_t key;
+} ImageEntry;
+
+typedef struct
+{
+   HashTable base;
+   const char *image;
+   size_t size;
+   const uint32_t *starts;
+   const ImageEntry *entries;
+} MappedTable;
+
+uint64_t alignKey(uint64_t offset)
+{
+   return (offset + KEY_ALIGN - 1) / KEY_ALIGN * KEY_ALIGN;
+}
+
+void readOnlyError()
+{
+   fprintf(stderr, "hash table is read only in %s at %d\n", __FILE__,
+      __LINE__);
+   exit(EXIT_FAILURE);
+}
+
+HTEntry imageEntry(MappedTable *mt, const ImageEntry *e)
+{
+   HTEntry entry;
+
+   entry.data = (void*)(mt->image + e->key);
+   entry.frequency = e->frequency;
+   return entry;
+}
+
+unsigned mappedAdd(HashTable *ht, void *data, unsigned hash)
+{
+   (void)ht;
+   (void)data;
+   (void)hash;
+   readOnlyError();
+   return 0;
+}
+
+HTEntry mappedLookUp(HashTable *ht, void *data, unsigned hash)
+{
+   MappedTable *mt = (MappedTable*)ht;
+   unsigned i = getIndex(ht, hash), j, end = mt->starts[i + 1];
+   HTEntry entry;
+
+   for(j = mt->starts[i]; j < end; j++)
+      if(mt->entries[j].hash == hash && dataCompare(ht, data,
+         (void*)(mt->image + mt->entries[j].key)) == 0)
+         return imageEntry(mt, &mt->entries[j]);
+   entry.data = NULL;
+   entry.frequency = 0;
+   return entry;
+}
+
+void mappedPrefetch(HashTable *ht, unsigned hash, int depth)
+{
+   MappedTable *mt = (MappedTable*)ht;
+   unsigned i = getIndex(ht, hash);
+
+   if(depth == 0)
+      HT_PREFETCH(&mt->starts[i]);
+   else
+      HT_PREFETCH(&mt->entries[mt->starts[i]]);
+}
+
+void mappedToArray(HashTable *ht, HTEntry *entryArr, unsigned size)
+{
+   MappedTable *mt = (MappedTable*)ht;
+   unsigned i;
+
+   for(i = 0; i < size && i < htUniqueEntries(ht); i++)
+      entryArr[i] = imageEntry(mt, &mt->entries[i]);
+}
+
+/* The entries are not stored as HTEntry, so each one is copied into the
+ * cursor. position is the image entry after the one returned.
+ */
+HTEntry* mappedIterNext(HashTable *ht, HTIter *iter, unsigned *hash)
+{
+   MappedTable *mt = (MappedTable*)ht;
+   unsigned j;
+
+   if(iter->bucket >= htCapacity(ht))
+      return NULL;
+   j = mt->starts[iter->bucket];
+   if(iter->position != NULL)
+      j = (unsigned)((const ImageEntry*)iter->position - mt->entries);
+   if(j >= htUniqueEntries(ht))
+   {
+      iter->bucket = htCapacity(ht);
+      return NULL;
+   }
+   while(mt->starts[iter->bucket + 1] <= j)
+      iter->bucket++;
+   iter->position = (void*)&mt->entries[j + 1];
+   iter->entry = imageEntry(mt, &mt->entries[j]);
+   if(hash != NULL)
+      *hash = mt->entries[j].hash;
+   return &iter->entry;
+}
+
+unsigned bucketLength(MappedTable *mt, unsigned i)
+{
+   return mt->starts[i + 1] - mt->starts[i];
+}
+
+HTMetrics mappedMetrics(HashTable *ht)
+{
+   MappedTable *mt = (MappedTable*)ht;
+   HTMetrics metrics;
+   unsigned i;
+
+   metrics.numberOfChains = 0;
+   metrics.maxChainLength = 0;
+   metrics.avgChainLength = 0;
+   for(i = 0; i < htCapacity(ht); i++)
+   {
+      if(bucketLength(mt, i) == 0)
+         continue;
+      metrics.numberOfChains++;
+      if(bucketLength(mt, i) > metrics.maxChainLength)
+         metrics.maxChainLength = bucketLength(mt, i);
+   }
+   if(metrics.numberOfChains)
+      metrics.avgChainLength = (float)htUniqueEntries(ht) /
+         metrics.numberOfChains;
+   return metrics;
+}
+
+unsigned mappedProbeLengths(HashTable *ht, unsigned *counts,
+   unsigned numCounts)
+{
+   MappedTable *mt = (MappedTable*)ht;
+   unsigned i, j, maxProbes = 0;
+
+   for(i = 0; i < htCapacity(ht); i++)
+   {
+      for(j = 1; j <= bucketLength(mt, i); j++)
+         countProbe(counts, numCounts, j);
+      if(bucketLength(mt, i) > maxProbes)
+         maxProbes = bucketLength(mt, i);
+   }
+   return maxProbes;
+}
+
+double mappedMissProbes(HashTable *ht)
+{
+   return (double)htUniqueEntries(ht) / htCapacity(ht);
+}
+
+/* The image is mapped rather than allocated: its bucket starts (and
+ * header), entries and keys are reported as buckets, nodes and keys.
+ */
+void mappedMemoryUsage(HashTable *ht, HTMemoryUsage *usage,
+   unsigned *allocations)
+{
+   MappedTable *mt = (MappedTable*)ht;
+   const ImageHeader *header = (const ImageHeader*)mt->image;
+
+   usage->tableBytes += sizeof(MappedTable);
+   usage->bucketBytes += (size_t)header->entriesOffset;
+   usage->nodeBytes += (size_t)(header->keysOffset - header->entriesOffset);
+   usage->keyBytes += mt->size - (size_t)header->keysOffset;
+   (*allocations)++;
+}
+
+void mappedDestroy(HashTable *ht)
+{
+   MappedTable *mt = (MappedTable*)ht;
+
+   munmap((void*)mt->image, mt->size);
+   freeTable(ht);
+}
+
+const HTEngine mappedEngine =
+{
+   mappedAdd,
+   mappedLookUp,
+   NULL,
+   NULL,
+   mappedPrefetch,
+   mappedToArray,
+   mappedIterNext,
+   mappedMetrics,
+   mappedProbeLengths,
+   mappedMissProbes,
+   mappedMemoryUsage,
+   NULL,
+   mappedDestroy
+};
+
+/* starts[i + 1] counts the entries of bucket i, then the running sum makes
+ * starts[i] the first entry of bucket i.
+ */
+uint32_t* bucketStarts(HashTable *ht, unsigned capacity)
+{
+   uint32_t *starts = calloc(capacity + 1, sizeof(uint32_t));
+   unsigned hash, i;
+   HTIter iter;
+
+   if(starts == NULL)
+      mallocError();
+   htIterBegin(ht, &iter, 0);
+   while(ht->engine->iterNext(ht, &iter, &hash) != NULL)
+      starts[hash % capacity + 1]++;
+   for(i = 0; i < capacity; i++)
+      starts[i + 1] += starts[i];
+   return starts;
+}
+
+/* Writes one key at offset *keys, padded to KEY_ALIGN, growing the scratch
+ * buffer until FNSerialize fits.
+ */
+int writeKey(FILE *file, FNSerialize serialize, void *data, char **buffer,
+   size_t *bufferSize, uint64_t *keys)
+{
+   size_t size = serialize(data, *buffer, *bufferSize);
+
+   if(alignKey(size) > *bufferSize)
+   {
+      free(*buffer);
+      *bufferSize = alignKey(size) * 2;
+      if((*buffer = malloc(*bufferSize)) == NULL)
+         mallocError();
+      serialize(data, *buffer, *bufferSize);
+   }
+   memset(*buffer + size, 0, alignKey(size) - size);
+   size = alignKey(size);
+   if(fwrite(*buffer, 1, size, file) != size)
+      return -1;
+   *keys += size;
+   return 0;
+}
+
+/* Streams the keys from header->keysOffset on, in table order, and records
+ * every entry in its bucket's next free place.
+ */
+int writeKeys(FILE *file, HashTable *ht, FNSerialize serialize,
+   ImageHeader *header, uint32_t *starts, ImageEntry *entries)
+{
+   uint32_t *next = malloc(header->capacity * sizeof(uint32_t));
+   size_t bufferSize = 256;
+   char *buffer = malloc(bufferSize);
+   uint64_t keys = header->keysOffset;
+   ImageEntry *e;
+   HTEntry *entry;
+   HTIter iter;
+   unsigned hash;
+   int status = 0;
+
+   if(next == NULL || buffer == NULL)
+      mallocError();
+   memcpy(next, starts, header->capacity * sizeof(uint32_t));
+   htIterBegin(ht, &iter, 0);
+   while(status == 0 && (entry = ht->engine->iterNext(ht, &iter, &hash)))
+   {
+      e = &entries[next[hash % header->capacity]++];
+      e->hash = hash;
+      e->frequency = entry->frequency;
+      e->key = keys;
+      status = writeKey(file, serialize, entry->data, &buffer, &bufferSize,
+         &keys);
+   }
+   header->size = keys;
+   free(buffer);
+   free(next);
+   return status;
+}
+
+void initHeader(ImageHeader *header, HashTable *ht)
+{
+   memset(header, 0, sizeof(ImageHeader));
+   memcpy(header->magic, IMAGE_MAGIC, sizeof(header->magic));
+   header->version = IMAGE_VERSION;
+   header->byteOrder = IMAGE_BYTE_ORDER;
+   header->capacity = htCapacity(ht);
+   header->uniqueEntries = htUniqueEntries(ht);
+   header->totalEntries = htTotalEntries(ht);
+   header->entriesOffset = alignKey(sizeof(ImageHeader) +
+      ((uint64_t)header->capacity + 1) * sizeof(uint32_t));
+   header->keysOffset = header->entriesOffset +
+      header->uniqueEntries * (uint64_t)sizeof(ImageEntry);
+}
+
+/* The keys come first since the entries need their offsets. */
+int writeImage(FILE *file, HashTable *ht, FNSerialize serialize)
+{
+   uint32_t *starts = bucketStarts(ht, htCapacity(ht));
+   ImageEntry *entries = malloc(htUniqueEntries(ht) * sizeof(ImageEntry) + 1);
+   ImageHeader header;
+   char pad[KEY_ALIGN] = {0};
+   size_t startsSize, padSize;
+   int status;
+
+   if(entries == NULL)
+      mallocError();
+   initHeader(&header, ht);
+   startsSize = (header.capacity + 1) * sizeof(uint32_t);
+   padSize = header.entriesOffset - sizeof(header) - startsSize;
+   status = fseeko(file, (off_t)header.keysOffset, SEEK_SET) != 0 ||
+      writeKeys(file, ht, serialize, &header, starts, entries) != 0 ||
+      fseeko(file, 0, SEEK_SET) != 0 ||
+      fwrite(&header, sizeof(header), 1, file) != 1 ||
+      fwrite(starts, startsSize, 1, file) != 1 ||
+      (padSize && fwrite(pad, padSize, 1, file) != 1) ||
+      fwrite(entries, sizeof(ImageEntry), header.uniqueEntries, file) !=
+         header.uniqueEntries;
+   free(entries);
+   free(starts);
+   return status ? -1 : 0;
+}
+
+/* Writes the image to a file only this process uses and flushes it to
+ * disk, so it is complete before it is renamed over the target.
+ */
+int writeTemp(const char *temp, HashTable *ht, FNSerialize serialize)
+{
+   FILE *file;
+   int status;
+
+   if((file = fopen(temp, "wb")) == NULL)
+      return -1;
+   status = writeImage(file, ht, serialize);
+   if(status == 0 && (fflush(file) != 0 || fsync(fileno(file)) != 0))
+      status = -1;
+   if(fclose(file) != 0)
+      status = -1;
+   return status;
+}
+
+int htSave(void *hashTable, const char *path, FNSerialize serialize)
+{
+   char *temp;
+   int status;
+
+   assert(hashTable != NULL && path != NULL && serialize != NULL);
+
+   if((temp = malloc(strlen(path) + 32)) == NULL)
+      mallocError();
+   sprintf(temp, "%s.%ld.tmp", path, (long)getpid());
+   status = writeTemp(temp, hashTable, serialize);
+   if(status == 0 && rename(temp, path) != 0)
+      status = -1;
+   if(status != 0)
+      remove(temp);
+   free(temp);
+   return status;
+}
+
+/* A lookup scans entries starts[i] to starts[i + 1], so they must rise
+ * from 0 to the number of entries without ever going back.
+ */
+int validStarts(const uint32_t *starts, unsigned capacity, unsigned unique)
+{
+   unsigned i;
+
+   if(starts[0] != 0 || starts[capacity] != unique)
+      return 0;
+   for(i = 0; i < capacity; i++)
+      if(starts[i] > starts[i + 1])
+         return 0;
+   return 1;
+}
+
+/* Every offset must stay inside the image before any of it is trusted. */
+int validImage(const char *image, size_t size)
+{
+   const ImageHeader *h = (const ImageHeader*)image;
+
+   if(size < sizeof(ImageHeader) ||
+      memcmp(h->magic, IMAGE_MAGIC, sizeof(h->magic)) != 0 ||
+      h->version != IMAGE_VERSION || h->byteOrder != IMAGE_BYTE_ORDER ||
+      h->size != size || h->capacity == 0 ||
+      h->entriesOffset != alignKey(sizeof(ImageHeader) +
+         ((uint64_t)h->capacity + 1) * sizeof(uint32_t)) ||
+      h->keysOffset != h->entriesOffset +
+         h->uniqueEntries * (uint64_t)sizeof(ImageEntry) ||
+      h->keysOffset > size)
+      return 0;
+   return validStarts((const uint32_t*)(image + sizeof(ImageHeader)),
+      h->capacity, h->uniqueEntries);
+}
+
+void* htLoadMapped(const char *path, HTFunctions *functions)
+{
+   unsigned capacity;
+   struct stat st;
+   MappedTable *mt;
+   HTOptions options;
+   void *image;
+   int fd;
+
+   assert(path != NULL && functions != NULL);
+
+   if((fd = open(path, O_RDONLY)) < 0)
+      return NULL;
+   if(fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(ImageHeader) ||
+      (image = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0))
+      == MAP_FAILED)
+   {
+      close(fd);
+      return NULL;
+   }
+   close(fd);
+   if(!validImage(image, (size_t)st.st_size))
+   {
+      munmap(image, (size_t)st.st_size);
+      return NULL;
+   }
+
+   if((mt = malloc(sizeof(MappedTable))) == NULL)
+      mallocError();
+   htDefaultOptions(&options);
+   options.indexMode = HT_INDEX_RECIPROCAL;
+   capacity = ((ImageHeader*)image)->capacity;
+   initTable(&mt->base, functions, &capacity, 1, 1, &options);
+   mt->base.engine = &mappedEngine;
+   mt->base.uniqueEntries = ((ImageHeader*)image)->uniqueEntries;
+   mt->base.totalEntries = ((ImageHeader*)image)->totalEntries;
+   mt->image = image;
+   mt->size = (size_t)st.st_size;
+   mt->starts = (const uint32_t*)(mt->image + sizeof(ImageHeader));
+   mt->entries = (const ImageEntry*)(mt->image +
+      ((ImageHeader*)image)->entriesOffset);
+   assert(mt->base.uniqueEntries == 0 || functions->hash((void*)(mt->image +
+      mt->entries[0].key)) == mt->entries[0].hash);
+   return &mt->base;
+}
@@ -0,0 +1,152 @@
+#include "hashTable.h"
+#include "hashTablePriv.h"
+#include <math.h>
+#include <stdlib.h>
+
+/* htMetricsEx. The distribution metrics only need the cached hash of every
+ * entry, so they are computed the same way for every engine: the entries
+ * are counted per home bucket, those counts are turned into a histogram and
+ * the histogram is compared with the Poisson distribution that a random
+ * hash of unique entries into capacity buckets would give.
+ */
+#define MIN_EXPECTED 5.0
+
+/* Returns the number of entries per home bucket and the largest of them. */
+unsigned* bucketLoads(HashTable *ht, unsigned *maxLoad)
+{
+   unsigned *loads = calloc(htCapacity(ht), sizeof(unsigned)), hash, i;
+   HTIter iter;
+
+   if(loads == NULL)
+      mallocError();
+   *maxLoad = 0;
+   htIterBegin(ht, &iter, 0);
+   while(ht->engine->iterNext(ht, &iter, &hash) != NULL)
+   {
+      i = getIndex(ht, hash);
+      if(++loads[i] > *maxLoad)
+         *maxLoad = loads[i];
+   }
+   return loads;
+}
+
+void fillHistogram(HashTable *ht, HTMetricsEx *metrics)
+{
+   unsigned i, maxLoad, *loads = bucketLoads(ht, &maxLoad);
+
+   metrics->histogramLength = maxLoad + 1;
+   metrics->histogram = calloc(maxLoad + 1, sizeof(unsigned));
+   if(metrics->histogram == NULL)
+      mallocError();
+   for(i = 0; i < htCapacity(ht); i++)
+      metrics->histogram[loads[i]]++;
+   free(loads);
+}
+
+void loadMoments(HTMetricsEx *metrics, double buckets, double mean)
+{
+   unsigned i;
+   double sum = 0;
+
+   for(i = 0; i < metrics->histogramLength; i++)
+      sum += metrics->histogram[i] * (i - mean) * (i - mean);
+   metrics->loadVariance = sum / buckets;
+   metrics->emptyBucketRatio = metrics->histogram[0] / buckets;
+}
+
+/* Neighbouring loads are pooled into one class until it expects at least
+ * MIN_EXPECTED buckets; the last class also takes every load beyond the
+ * largest one seen. One degree of freedom is lost to the total and one to
+ * the mean, which is estimated from the table.
+ */
+void chiSquare(HTMetricsEx *metrics, double buckets, double mean)
+{
+   unsigned i, classes = 0;
+   double p = exp(-mean), expected = 0, observed = 0, cumulative = 0;
+
+   metrics->chiSquare = 0;
+   for(i = 0; i < metrics->histogramLength; i++)
+   {
+      observed += metrics->histogram[i];
+      expected += buckets * p;
+      cumulative += buckets * p;
+      p *= mean / (i + 1);
+      if(expected >= MIN_EXPECTED && buckets - cumulative >= MIN_EXPECTED)
+      {
+         metrics->chiSquare += (observed - expected) * (observed - expected) /
+            expected;
+         classes++;
+         observed = expected = 0;
+      }
+   }
+   expected += buckets - cumulative;
+   if(expected > 0)
+   {
+      metrics->chiSquare += (observed - expected) * (observed - expected) /
+         expected;
+      classes++;
+   }
+   metrics->degreesOfFreedom = classes > 2 ? classes - 2 : 0;
+}
+
+double hitProbes(HashTable *ht)
+{
+   unsigned i, *counts, maxProbes = ht->engine->probeLengths(ht, NULL, 0);
+   double probes = 0, entries = 0;
+
+   if(maxProbes == 0)
+      return 0;
+   if((counts = calloc(maxProbes, sizeof(unsigned))) == NULL)
+      mallocError();
+   ht->engine->probeLengths(ht, counts, maxProbes);
+   for(i = 0; i < maxProbes; i++)
+   {
+      probes += (double)(i + 1) * counts[i];
+      entries += counts[i];
+   }
+   free(counts);
+   return probes / entries;
+}
+
+/* glibc's malloc keeps an 8 byte header per block and rounds blocks to 16
+ * bytes, so on average a block costs about this much more than requested.
+ */
+#define MALLOC_SLACK 16
+
+HTMemoryUsage htMemoryUsage(void *hashTable)
+{
+   HashTable *ht = hashTable;
+   HTMemoryUsage usage;
+   unsigned allocations = 4 + ht->keyAllocs + (ht->bloom != NULL);
+
+   usage.tableBytes = sizeof(HTFunctions) + bloomBytes(ht) + ht->numSizes *
+      (2 * sizeof(unsigned) + sizeof(uint64_t));
+   usage.bucketBytes = 0;
+   usage.nodeBytes = 0;
+   usage.entryBytes = (size_t)htUniqueEntries(ht) * sizeof(HTEntry);
+   usage.keyBytes = ht->keyBytes;
+   usage.dataBytes = ht->dataBytes;
+   ht->engine->memoryUsage(ht, &usage, &allocations);
+   usage.slackBytes = (size_t)allocations * MALLOC_SLACK;
+   usage.totalBytes = usage.tableBytes + usage.bucketBytes + usage.nodeBytes +
+      usage.keyBytes + usage.dataBytes + usage.slackBytes;
+   return usage;
+}
+
+void htMetricsEx(void *hashTable, HTMetricsEx *metrics)
+{
+   HashTable *ht = hashTable;
+   double buckets, mean;
+
+   metrics->basic = htMetrics(ht);
+   metrics->filterBytes = bloomBytes(ht);
+   fillHistogram(ht, metrics);
+
+   buckets = htCapacity(ht);
+   mean = htUniqueEntries(ht) / buckets;
+   loadMoments(metrics, buckets, mean);
+   chiSquare(metrics, buckets, mean);
+   metrics->hitProbes = hitProbes(ht);
+   metrics->missProbes = ht->engine->missProbes(ht);
+   metrics->memory = htMemoryUsage(ht);
+}
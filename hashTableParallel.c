@@ -0,0 +1,283 @@
+#define _POSIX_C_SOURCE 200112L
+#include "hashTable.h"
+#include "hashTablePriv.h"
+#include <pthread.h>
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+/* Parallel operations of the chaining engine for very large tables.
+ *
+ * Partitioned rehash: the new bucket array is split into one contiguous range (partition) per
+ * worker. In the scatter phase worker s walks its share of the old buckets
+ * and links every node onto list (s, p), p being the partition of the
+ * node's new bucket. In the gather phase worker p appends the nodes of lists
+ * (0, p) .. (T-1, p) to the chains of its own range, remembering the tail
+ * of every chain instead of walking to it. No two workers ever write the
+ * same node or bucket, and nodes keep the relative order a serial rehash
+ * would give them.
+ */
+typedef struct
+{
+   HashNode *head, *tail;
+} NodeList;
+
+typedef struct
+{
+   HashTable *ht;
+   HashNode **oldArr, **newArr, **tails;
+   unsigned oldSize, newSize, numThreads;
+   NodeList *lists;
+} RehashJob;
+
+typedef struct
+{
+   RehashJob *job;
+   unsigned id;
+} RehashWorker;
+
+unsigned rangeStart(unsigned size, unsigned part, unsigned numParts)
+{
+   return (unsigned)(((uint64_t)size * part + numParts - 1) / numParts);
+}
+
+unsigned partitionOf(unsigned i, unsigned size, unsigned numParts)
+{
+   return (unsigned)((uint64_t)i * numParts / size);
+}
+
+void appendList(NodeList *list, HashNode *node)
+{
+   if(list->tail)
+      list->tail->next = node;
+   else
+      list->head = node;
+   list->tail = node;
+}
+
+void scatterChain(RehashJob *job, unsigned s, HashNode *node)
+{
+   HashNode *next;
+   unsigned p;
+
+   for(; node; node = next)
+   {
+      next = node->next;
+      p = partitionOf(getIndex(job->ht, node->hash), job->newSize,
+         job->numThreads);
+      appendList(&job->lists[s * job->numThreads + p], node);
+   }
+}
+
+void* scatterWorker(void *arg)
+{
+   RehashJob *job = ((RehashWorker*)arg)->job;
+   unsigned s = ((RehashWorker*)arg)->id, i;
+   unsigned end = rangeStart(job->oldSize, s + 1, job->numThreads);
+
+   for(i = rangeStart(job->oldSize, s, job->numThreads); i < end; i++)
+      scatterChain(job, s, job->oldArr[i]);
+   return NULL;
+}
+
+void gatherNode(RehashJob *job, HashNode *node)
+{
+   unsigned i = getIndex(job->ht, node->hash);
+
+   node->next = NULL;
+   if(job->tails[i])
+      job->tails[i]->next = node;
+   else
+      job->newArr[i] = node;
+   job->tails[i] = node;
+}
+
+void* gatherWorker(void *arg)
+{
+   RehashJob *job = ((RehashWorker*)arg)->job;
+   unsigned p = ((RehashWorker*)arg)->id, s;
+   NodeList *list;
+   HashNode *node, *next;
+
+   for(s = 0; s < job->numThreads; s++)
+   {
+      list = &job->lists[s * job->numThreads + p];
+      if(list->tail)
+         list->tail->next = NULL;
+      for(node = list->head; node; node = next)
+      {
+         next = node->next;
+         gatherNode(job, node);
+      }
+   }
+   return NULL;
+}
+
+/* Runs fn once per worker, the last one on the calling thread. A worker
+ * whose thread cannot be created runs on the calling thread too.
+ */
+void runWorkers(void *(*fn)(void*), void *args, size_t argSize,
+   unsigned numThreads)
+{
+   pthread_t *threads = malloc(numThreads * sizeof(pthread_t));
+   char *started = calloc(numThreads, 1);
+   unsigned t;
+
+   if(threads == NULL || started == NULL)
+      mallocError();
+   for(t = 0; t + 1 < numThreads; t++)
+      started[t] = pthread_create(&threads[t], NULL, fn,
+         (char*)args + t * argSize) == 0;
+   for(t = numThreads; t-- > 0;)
+   {
+      if(started[t])
+         pthread_join(threads[t], NULL);
+      else
+         fn((char*)args + t * argSize);
+   }
+   free(threads);
+   free(started);
+}
+
+void partitionedRehash(HashTable *ht, HashNode **oldArr, unsigned oldSize,
+   HashNode **newArr)
+{
+   RehashJob job;
+   RehashWorker *workers;
+   unsigned t;
+
+   job.ht = ht;
+   job.oldArr = oldArr;
+   job.newArr = newArr;
+   job.oldSize = oldSize;
+   job.newSize = htCapacity(ht);
+   job.numThreads = ht->rehashThreads;
+   job.lists = calloc(job.numThreads * job.numThreads, sizeof(NodeList));
+   job.tails = calloc(job.newSize, sizeof(HashNode*));
+   workers = malloc(job.numThreads * sizeof(RehashWorker));
+   if(job.lists == NULL || job.tails == NULL || workers == NULL)
+      mallocError();
+
+   for(t = 0; t < job.numThreads; t++)
+   {
+      workers[t].job = &job;
+      workers[t].id = t;
+   }
+   runWorkers(scatterWorker, workers, sizeof(RehashWorker), job.numThreads);
+   runWorkers(gatherWorker, workers, sizeof(RehashWorker), job.numThreads);
+
+   free(workers);
+   free(job.tails);
+   free(job.lists);
+}
+
+/* Parallel merge. Every table is first grown to the largest size among them
+ * so that, with the same sizes and index mode, bucket i of any table only
+ * holds entries belonging in bucket i of the first. Worker p then folds the
+ * buckets of its range from every other table into the first table, so no
+ * two workers ever touch the same chain. Duplicates folded away are kept on
+ * a list per worker and freed once the workers are done, so the memory
+ * counts are only updated by the calling thread.
+ */
+typedef struct
+{
+   void **tables;
+   unsigned numTables, numThreads;
+} MergeJob;
+
+typedef struct
+{
+   MergeJob *job;
+   unsigned id, linked;
+   HashNode *folded;
+} MergeWorker;
+
+void* mergeWorker(void *arg)
+{
+   MergeWorker *worker = arg;
+   MergeJob *job = worker->job;
+   HashTable *ht = job->tables[0];
+   unsigned size = htCapacity(ht), i, t;
+   unsigned end = rangeStart(size, worker->id + 1, job->numThreads);
+   HashNode *node, *next;
+
+   for(i = rangeStart(size, worker->id, job->numThreads); i < end; i++)
+      for(t = 1; t < job->numTables; t++)
+         for(node = ((HashTable*)job->tables[t])->arr[i]; node; node = next)
+         {
+            next = node->next;
+            if(mergeNode(ht, i, node) != NULL)
+            {
+               node->next = worker->folded;
+               worker->folded = node;
+            }
+            else
+               worker->linked++;
+         }
+   return NULL;
+}
+
+void checkAligned(HashTable *dst, HashTable *src)
+{
+   int i;
+
+   checkMergeable(dst, src);
+   assert(dst->numSizes == src->numSizes);
+   assert(dst->indexMode == src->indexMode);
+   for(i = 0; i < dst->numSizes; i++)
+      assert(dst->sizes[i] == src->sizes[i]);
+}
+
+void htMergeAll(void *tables[], unsigned numTables, unsigned numThreads)
+{
+   HashTable *ht = tables[0];
+   MergeJob job;
+   MergeWorker *workers;
+   HashNode *node, *next;
+   unsigned t, sizeIndex = 0;
+
+   assert(numTables >= 1);
+   assert(numThreads >= 1);
+   for(t = 0; t < numTables; t++)
+   {
+      if(t > 0)
+      {
+         checkAligned(ht, tables[t]);
+         adoptUsage(ht, tables[t]);
+      }
+      if(((HashTable*)tables[t])->sizeIndex > sizeIndex)
+         sizeIndex = ((HashTable*)tables[t])->sizeIndex;
+   }
+   for(t = 0; t < numTables; t++)
+      growTo(tables[t], sizeIndex);
+
+   job.tables = tables;
+   job.numTables = numTables;
+   job.numThreads = numThreads;
+   if((workers = malloc(numThreads * sizeof(MergeWorker))) == NULL)
+      mallocError();
+   for(t = 0; t < numThreads; t++)
+   {
+      workers[t].job = &job;
+      workers[t].id = t;
+      workers[t].linked = 0;
+      workers[t].folded = NULL;
+   }
+   runWorkers(mergeWorker, workers, sizeof(MergeWorker), numThreads);
+
+   for(t = 0; t < numThreads; t++)
+   {
+      entryCount(ht, 0, workers[t].linked);
+      for(node = workers[t].folded; node; node = next)
+      {
+         next = node->next;
+         dropNode(ht, node);
+      }
+   }
+   for(t = 1; t < numTables; t++)
+      adoptTable(ht, tables[t]);
+   growMerged(ht);
+   bloomRefresh(ht);
+   free(workers);
+}
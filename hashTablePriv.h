@@ -0,0 +1,229 @@
+/* Private declarations shared by the hash table engines. Nothing in here is
+ * part of the public interface - users include hashTable.h and, for the
+ * extended features, hashTableEx.h.
+ */
+#ifndef HASHTABLEPRIV_H
+#define HASHTABLEPRIV_H
+
+#include "hashTable.h"
+#include "hashTableEx.h"
+#include <stddef.h>
+#include <stdint.h>
+
+/* The full (unreduced) hash of the data is cached in each node so chains can
+ * be searched without calling FNCompare on every neighbour and rehashing
+ * never needs to call FNHash again.
+ */
+typedef struct node
+{
+   HTEntry entry;
+   unsigned hash;
+   struct node *next;
+} HashNode;
+
+typedef struct hashTable HashTable;
+
+/* Nodes are carved out of slabs owned by the table so adding a unique entry
+ * costs no allocator round trip in the common case and htDestroy releases
+ * whole slabs at once. The nodes array is allocated past the end of the
+ * structure (the "struct hack"). Nodes are nodeSize bytes apart, more than
+ * sizeof(HashNode) when keys are stored inline (see inlineKeyBytes in
+ * HTOptions) right after each node.
+ */
+typedef struct slab
+{
+   struct slab *next;
+   unsigned used, count;
+   HashNode nodes[1];
+} NodeSlab;
+
+typedef struct
+{
+   NodeSlab *slabs;
+   HashNode *freeList;
+   unsigned nextSlabCount, numSlabs;
+   size_t nodeSize, bytes;
+} NodePool;
+
+/* The string arena of htAddString: chunks of key bytes handed out by
+ * bumping used, the chunk being filled first in the list.
+ */
+typedef struct chunk
+{
+   struct chunk *next;
+   size_t size, used;
+   char bytes[1];
+} ArenaChunk;
+
+#define MIN_SLAB_NODES 32
+#define MAX_SLAB_NODES 16384
+
+#ifdef __GNUC__
+#define HT_PREFETCH(addr) __builtin_prefetch(addr)
+#else
+#define HT_PREFETCH(addr) ((void)(addr))
+#endif
+
+/* The engine "class": every public operation is forwarded through one of
+ * these after the data has been hashed exactly once.
+ *
+ * prefetch is used by the batch operations: depth 0 prefetches the bucket
+ * (or control bytes) the hash maps to, depth 1, issued once those have had
+ * time to arrive, prefetches what they point to.
+ *
+ * remove lowers the frequency of the matching entry by count (at most to 0)
+ * and unlinks it once it reaches 0 without freeing its data, returning the
+ * stored data with the remaining frequency (NULL data when there is no
+ * match). resize moves the entries to the table for sizes[sizeIndex]. Both
+ * are NULL for engines that do not support them.
+ *
+ * toArray copies at most size entries. iterNext advances a cursor (see
+ * htIterNext) and, when hash is not NULL, also reports the cached hash of
+ * the entry returned. count is NULL for engines that keep
+ * their counts in totalEntries and uniqueEntries, otherwise it returns the
+ * unique count when unique is nonzero and the total count when it is zero.
+ *
+ * probeLengths accepts NULL counts to only find the maximum. missProbes is
+ * the average number of nodes (slots, groups) an unsuccessful lookup visits
+ * over all the home buckets a hash can map to.
+ *
+ * memoryUsage adds the engine's own structures to usage in O(1): its table
+ * structure to tableBytes, bucketBytes and nodeBytes, anything it keeps
+ * count of itself to keyBytes and dataBytes, and the number of blocks it
+ * has allocated to *allocations.
+ */
+typedef struct
+{
+   unsigned (*add)(HashTable *ht, void *data, unsigned hash);
+   HTEntry (*lookUp)(HashTable *ht, void *data, unsigned hash);
+   HTEntry (*remove)(HashTable *ht, void *data, unsigned hash,
+      unsigned count);
+   void (*resize)(HashTable *ht, unsigned sizeIndex);
+   void (*prefetch)(HashTable *ht, unsigned hash, int depth);
+   void (*toArray)(HashTable *ht, HTEntry *entryArr, unsigned size);
+   HTEntry* (*iterNext)(HashTable *ht, HTIter *iter, unsigned *hash);
+   HTMetrics (*metrics)(HashTable *ht);
+   unsigned (*probeLengths)(HashTable *ht, unsigned *counts,
+      unsigned numCounts);
+   double (*missProbes)(HashTable *ht);
+   void (*memoryUsage)(HashTable *ht, HTMemoryUsage *usage,
+      unsigned *allocations);
+   unsigned (*count)(HashTable *ht, int unique);
+   void (*destroy)(HashTable *ht);
+} HTEngine;
+
+/* The base table. The chaining engine uses the fields from arr on directly,
+ * the other engines embed this structure as their first member and leave
+ * them unused.
+ *
+ * inlineKeyBytes is the inline key room of each node, 0 when the table
+ * stores the caller's data as htCreate's tables do.
+ *
+ * strings is the arena of htAddString, NULL until its first call. From then
+ * on all of the data is in it (see arenaOwnsData).
+ *
+ * materialize and materializeContext are only set for the duration of an
+ * htFindOrInsert, addedData is the stored data of the entry the last add
+ * found or created (see newData and addDuplicate).
+ *
+ * dataSize is the FNSize of HTOptions. dataBytes totals it over the data
+ * the table owns, keyBytes is the size of the keys it has copied itself
+ * (arena chunks and spilled inline keys) in keyAllocs blocks.
+ *
+ * bloom is the optional Bloom filter consulted by htLookUp before the
+ * engine (see hashTableBloom.c), NULL when it is disabled.
+ *
+ * While an incremental rehash is in progress oldArr holds the buckets of the
+ * previous size (oldSize of them, for sizes[oldSizeIndex], which is the
+ * next larger size after a shrink) that have not been migrated to arr yet;
+ * migrated buckets are set to NULL and migrateIndex is the next bucket the
+ * background migration will move.
+ */
+struct hashTable
+{
+   const HTEngine *engine;
+   HTFunctions *functions;
+   unsigned *sizes, sizeIndex;
+   unsigned totalEntries, uniqueEntries;
+   int numSizes;
+   float rehashLoadFactor, shrinkLoadFactor;
+   HTIndexMode indexMode;
+   uint64_t *reciprocals;
+   unsigned *shifts;
+   HashNode **arr;
+   NodePool pool;
+   HashNode **oldArr;
+   unsigned oldSize, oldSizeIndex, migrateIndex;
+   unsigned incrementalRehash, rehashThreads;
+   HTChainOrder chainOrder;
+   unsigned inlineKeyBytes;
+   ArenaChunk *strings;
+   FNMaterialize materialize;
+   void *materializeContext, *addedData;
+   FNSize dataSize;
+   size_t dataBytes, keyBytes;
+   unsigned keyAllocs;
+   uint64_t *bloom;
+   unsigned bloomBlocks, bloomHashes, bloomEntries;
+   float bloomRate;
+};
+
+extern const HTEngine chainEngine;
+extern const HTEngine robinHoodEngine;
+extern const HTEngine swissEngine;
+extern const HTEngine concurrentEngine;
+
+void mallocError();
+void initPool(NodePool *pool, size_t nodeSize);
+HashNode* allocNode(NodePool *pool);
+void releaseNode(NodePool *pool, HashNode *node);
+void destroyPool(NodePool *pool, HashTable *ht);
+char* inlineKey(HashNode *node);
+void freeData(HashTable *ht, void *data);
+size_t ownedDataSize(HashTable *ht, void *data);
+void dropNode(HashTable *ht, HashNode *node);
+unsigned hashData(void *hashTable, void *data);
+unsigned addHashed(HashTable *ht, void *data, unsigned hash);
+void tableFullError();
+void initTable(HashTable *ht, HTFunctions *functions, unsigned sizes[],
+   int numSizes, float rehashLoadFactor, const HTOptions *options);
+void freeTable(HashTable *ht);
+int needsRehash(HashTable *ht);
+int lowerFrequency(HashTable *ht, HTEntry *entry, unsigned count);
+unsigned getIndex(void *hashTable, unsigned hash);
+unsigned reduceHash(HashTable *ht, unsigned hash, unsigned sizeIndex);
+void entryCount(void *hashTable, unsigned tot, unsigned unq);
+void* newData(HashTable *ht, void *data);
+unsigned addDuplicate(HashTable *ht, HTEntry *entry);
+unsigned dataCompare(void *hashTable, void *data1, void *data2);
+void countProbe(unsigned *counts, unsigned numCounts, unsigned probes);
+double chainMissProbes(HashTable *ht);
+HashNode* mergeNode(HashTable *ht, unsigned index, HashNode *node);
+void growTo(HashTable *ht, unsigned sizeIndex);
+void growMerged(HashTable *ht);
+void adoptUsage(HashTable *ht, HashTable *src);
+void adoptTable(HashTable *ht, HashTable *src);
+void checkMergeable(HashTable *dst, HashTable *src);
+int arenaOwnsData(HashTable *ht);
+void adoptArena(HashTable *ht, HashTable *src);
+void freeArena(HashTable *ht);
+void initBloom(HashTable *ht, float falsePositiveRate);
+int bloomMayContain(HashTable *ht, unsigned hash);
+void bloomAdded(HashTable *ht, unsigned freq, unsigned hash);
+void bloomRemoved(HashTable *ht);
+void bloomRefresh(HashTable *ht);
+size_t bloomBytes(HashTable *ht);
+unsigned rangeStart(unsigned size, unsigned part, unsigned numParts);
+void runWorkers(void *(*fn)(void*), void *args, size_t argSize,
+   unsigned numThreads);
+void partitionedRehash(HashTable *ht, HashNode **oldArr, unsigned oldSize,
+   HashNode **newArr);
+
+HashTable* rhCreate(HTFunctions *functions, unsigned sizes[], int numSizes,
+   float rehashLoadFactor, const HTOptions *options);
+HashTable* swissCreate(HTFunctions *functions, unsigned sizes[],
+   int numSizes, float rehashLoadFactor, const HTOptions *options);
+HashTable* concurrentCreate(HTFunctions *functions, unsigned sizes[],
+   int numSizes, float rehashLoadFactor, const HTOptions *options);
+
+#endif
@@ -0,0 +1,344 @@
+#include "hashTable.h"
+#include "hashTablePriv.h"
+#include <assert.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+/* A Robin Hood slot. The entry is stored inline with its cached hash and its
+ * distance from its home slot. Empty slots have NULL data.
+ */
+typedef struct
+{
+   HTEntry entry;
+   unsigned hash;
+   unsigned dist;
+} RHSlot;
+
+typedef struct
+{
+   HashTable base;
+   RHSlot *slots;
+} RHTable;
+
+void tableFullError()
+{
+   fprintf(stderr, "hash table full in %s at %d\n", __FILE__, __LINE__);
+   exit(EXIT_FAILURE);
+}
+
+unsigned rhNext(unsigned i, unsigned numSlots)
+{
+   return ++i == numSlots ? 0 : i;
+}
+
+RHSlot* rhAllocSlots(unsigned numSlots)
+{
+   RHSlot *slots = calloc(numSlots, sizeof(RHSlot));
+   if(slots == NULL)
+      mallocError();
+   return slots;
+}
+
+/* Places an entry known not to be in the table, starting at slot i with the
+ * carried entry's distance already set for that slot. Whenever the carried
+ * entry is further from home than the resident one they trade places.
+ */
+void rhPlace(RHSlot *slots, unsigned numSlots, RHSlot carry, unsigned i)
+{
+   RHSlot tmp;
+
+   while(slots[i].entry.data != NULL)
+   {
+      if(slots[i].dist < carry.dist)
+      {
+         tmp = slots[i];
+         slots[i] = carry;
+         carry = tmp;
+      }
+      i = rhNext(i, numSlots);
+      carry.dist++;
+   }
+   slots[i] = carry;
+}
+
+void rhMoveSlots(RHSlot *oldSlots, unsigned oldSize, void *hashTable)
+{
+   unsigned i;
+   RHSlot carry;
+
+   for(i = 0; i < oldSize; i++)
+   {
+      if(oldSlots[i].entry.data == NULL)
+         continue;
+      carry = oldSlots[i];
+      carry.dist = 0;
+      rhPlace(((RHTable*)hashTable)->slots, htCapacity(hashTable), carry,
+         getIndex(hashTable, carry.hash));
+   }
+}
+
+void rhResize(HashTable *ht, unsigned sizeIndex)
+{
+   RHTable *rh = (RHTable*)ht;
+   RHSlot *oldSlots = rh->slots;
+   unsigned oldSize = htCapacity(rh);
+
+   rh->base.sizeIndex = sizeIndex;
+   rh->slots = rhAllocSlots(htCapacity(rh));
+   rhMoveSlots(oldSlots, oldSize, rh);
+   free(oldSlots);
+}
+
+void rhRehash(RHTable *rh)
+{
+   rhResize(&rh->base, rh->base.sizeIndex + 1);
+}
+
+/* Besides the load factor rule a full table must grow while it can. */
+void rhCheckRehash(RHTable *rh)
+{
+   if(needsRehash(&rh->base) ||
+      (htUniqueEntries(rh) == htCapacity(rh) &&
+      rh->base.numSizes > rh->base.sizeIndex + 1))
+      rhRehash(rh);
+}
+
+/* Returns the matching slot or NULL. Either way *pos and *dist are left at
+ * the slot where the search stopped, which is where a new entry belongs.
+ */
+RHSlot* rhFind(RHTable *rh, void *data, unsigned hash, unsigned *pos,
+   unsigned *dist)
+{
+   unsigned numSlots = htCapacity(rh);
+   RHSlot *slot;
+
+   *pos = getIndex(rh, hash);
+   for(*dist = 0; *dist < numSlots; (*dist)++)
+   {
+      slot = &rh->slots[*pos];
+      if(slot->entry.data == NULL || slot->dist < *dist)
+         return NULL;
+      if(slot->hash == hash && dataCompare(rh, data, slot->entry.data) == 0)
+         return slot;
+      *pos = rhNext(*pos, numSlots);
+   }
+   return NULL;
+}
+
+unsigned rhAdd(HashTable *ht, void *data, unsigned hash)
+{
+   RHTable *rh = (RHTable*)ht;
+   RHSlot *slot, carry;
+   unsigned pos, dist;
+
+   rhCheckRehash(rh);
+
+   if((slot = rhFind(rh, data, hash, &pos, &dist)) != NULL)
+      return addDuplicate(ht, &slot->entry);
+   if(htUniqueEntries(ht) == htCapacity(ht))
+      tableFullError();
+
+   carry.entry.data = newData(ht, data);
+   carry.entry.frequency = 1;
+   carry.hash = hash;
+   carry.dist = dist;
+   rhPlace(rh->slots, htCapacity(ht), carry, pos);
+   entryCount(ht, 1, 1);
+   return 1;
+}
+
+/* Backward shift deletion: the entries following the removed one move back
+ * a slot until an empty slot or an entry already in its home slot is
+ * reached, so no tombstones are needed.
+ */
+void rhShiftBack(RHSlot *slots, unsigned numSlots, unsigned pos)
+{
+   unsigned next = rhNext(pos, numSlots);
+
+   while(slots[next].entry.data != NULL && slots[next].dist > 0)
+   {
+      slots[pos] = slots[next];
+      slots[pos].dist--;
+      pos = next;
+      next = rhNext(next, numSlots);
+   }
+   slots[pos].entry.data = NULL;
+}
+
+HTEntry rhRemove(HashTable *ht, void *data, unsigned hash, unsigned count)
+{
+   HTEntry entry;
+   RHSlot *slot;
+   unsigned pos, dist;
+
+   entry.data = NULL;
+   entry.frequency = 0;
+   if((slot = rhFind((RHTable*)ht, data, hash, &pos, &dist)) == NULL)
+      return entry;
+   if(!lowerFrequency(ht, &slot->entry, count))
+      return slot->entry;
+   entry = slot->entry;
+   rhShiftBack(((RHTable*)ht)->slots, htCapacity(ht), pos);
+   return entry;
+}
+
+HTEntry rhLookUp(HashTable *ht, void *data, unsigned hash)
+{
+   HTEntry entry;
+   RHSlot *slot;
+   unsigned pos, dist;
+
+   entry.data = NULL;
+   entry.frequency = 0;
+   if((slot = rhFind((RHTable*)ht, data, hash, &pos, &dist)) != NULL)
+      entry = slot->entry;
+   return entry;
+}
+
+void rhToArray(HashTable *ht, HTEntry *entryArr,
+   unsigned size)
+{
+   RHSlot *slots = ((RHTable*)ht)->slots;
+   unsigned i, j = 0;
+
+   for(i = 0; j < size && i < htCapacity(ht); i++)
+      if(slots[i].entry.data != NULL)
+         entryArr[j++] = slots[i].entry;
+}
+
+/* A fresh cursor (no position yet) starts with its own bucket. */
+HTEntry* rhIterNext(HashTable *ht, HTIter *iter, unsigned *hash)
+{
+   RHSlot *slots = ((RHTable*)ht)->slots;
+   unsigned i = iter->position ? iter->bucket + 1 : iter->bucket;
+
+   for(; i < htCapacity(ht); i++)
+   {
+      if(slots[i].entry.data == NULL)
+         continue;
+      iter->bucket = i;
+      iter->position = &slots[i];
+      if(hash != NULL)
+         *hash = slots[i].hash;
+      return &slots[i].entry;
+   }
+   iter->bucket = htCapacity(ht);
+   return NULL;
+}
+
+HTMetrics rhMetrics(HashTable *ht)
+{
+   RHSlot *slots = ((RHTable*)ht)->slots;
+   HTMetrics metrics;
+   unsigned i;
+   double probes = 0;
+
+   metrics.numberOfChains = 0;
+   metrics.maxChainLength = 0;
+   metrics.avgChainLength = 0;
+
+   for(i = 0; i < htCapacity(ht); i++)
+   {
+      if(slots[i].entry.data == NULL)
+         continue;
+      metrics.numberOfChains++;
+      probes += slots[i].dist + 1;
+      if(slots[i].dist + 1 > metrics.maxChainLength)
+         metrics.maxChainLength = slots[i].dist + 1;
+   }
+   if(metrics.numberOfChains)
+      metrics.avgChainLength = (float)(probes / metrics.numberOfChains);
+   return metrics;
+}
+
+unsigned rhProbeLengths(HashTable *ht, unsigned *counts, unsigned numCounts)
+{
+   RHSlot *slots = ((RHTable*)ht)->slots;
+   unsigned i, maxProbes = 0;
+
+   for(i = 0; i < htCapacity(ht); i++)
+   {
+      if(slots[i].entry.data == NULL)
+         continue;
+      countProbe(counts, numCounts, slots[i].dist + 1);
+      if(slots[i].dist + 1 > maxProbes)
+         maxProbes = slots[i].dist + 1;
+   }
+   return maxProbes;
+}
+
+/* A miss starting at home slot i stops at the first empty slot or the first
+ * entry closer to its own home than the search is to i.
+ */
+double rhMissProbes(HashTable *ht)
+{
+   RHSlot *slots = ((RHTable*)ht)->slots;
+   unsigned i, pos, dist, numSlots = htCapacity(ht);
+   double probes = 0;
+
+   for(i = 0; i < numSlots; i++)
+   {
+      for(pos = i, dist = 0; dist < numSlots && slots[pos].entry.data != NULL
+         && slots[pos].dist >= dist; dist++)
+         pos = rhNext(pos, numSlots);
+      probes += dist < numSlots ? dist + 1 : dist;
+   }
+   return probes / numSlots;
+}
+
+void rhMemoryUsage(HashTable *ht, HTMemoryUsage *usage,
+   unsigned *allocations)
+{
+   usage->tableBytes += sizeof(RHTable);
+   usage->bucketBytes += htCapacity(ht) * sizeof(RHSlot);
+   *allocations += 2;
+}
+
+void rhDestroy(HashTable *ht)
+{
+   RHSlot *slots = ((RHTable*)ht)->slots;
+   unsigned i;
+
+   for(i = 0; i < htCapacity(ht); i++)
+      if(slots[i].entry.data != NULL)
+         freeData(ht, slots[i].entry.data);
+   free(slots);
+   freeTable(ht);
+}
+
+/* The slot itself holds the entry so there is nothing further to fetch. */
+void rhPrefetch(HashTable *ht, unsigned hash, int depth)
+{
+   if(depth == 0)
+      HT_PREFETCH(&((RHTable*)ht)->slots[getIndex(ht, hash)]);
+}
+
+const HTEngine robinHoodEngine = {
+   rhAdd,
+   rhLookUp,
+   rhRemove,
+   rhResize,
+   rhPrefetch,
+   rhToArray,
+   rhIterNext,
+   rhMetrics,
+   rhProbeLengths,
+   rhMissProbes,
+   rhMemoryUsage,
+   NULL,
+   rhDestroy
+};
+
+HashTable* rhCreate(HTFunctions *functions, unsigned sizes[], int numSizes,
+   float rehashLoadFactor, const HTOptions *options)
+{
+   RHTable *rh = malloc(sizeof(RHTable));
+   if(rh == NULL)
+      mallocError();
+
+   initTable(&rh->base, functions, sizes, numSizes, rehashLoadFactor,
+      options);
+   rh->base.engine = &robinHoodEngine;
+   rh->slots = rhAllocSlots(htCapacity(rh));
+   return &rh->base;
+}
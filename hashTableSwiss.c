@@ -0,0 +1,424 @@
+#include "hashTable.h"
+#include "hashTablePriv.h"
+#include <assert.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/* A SwissTable style engine. Every slot has a one byte control tag holding
+ * either EMPTY, DELETED or 7 bits mixed from the slot's hash, and the tags
+ * are laid out in groups of GROUP_SIZE so a whole group is matched with a
+ * couple of SSE2 instructions before FNCompare is called for the (rare) tag
+ * matches.
+ *
+ * A search stops at the first group with an EMPTY slot, so a removed entry
+ * leaves a DELETED tombstone unless its own group has an EMPTY slot (then no
+ * search can ever have passed the group). Adds reuse tombstones, and once
+ * entries and tombstones fill 7/8 of the slots the table is rebuilt.
+ */
+#define GROUP_SIZE 16
+#define CTRL_EMPTY ((unsigned char)0x80)
+#define CTRL_DELETED ((unsigned char)0xFE)
+#define TAG_MULTIPLIER 0x85EBCA6Bu
+
+typedef struct
+{
+   HTEntry entry;
+   unsigned hash;
+} SwissSlot;
+
+typedef struct
+{
+   HashTable base;
+   unsigned char *ctrl;
+   SwissSlot *slots;
+   unsigned numGroups, deleted;
+} SwissTable;
+
+/* HT_INDEX_MULTIPLY_SHIFT and HT_INDEX_FIBONACCI pick the home group from
+ * the high bits of the hash (or of its Fibonacci product), so the tag must
+ * not simply repeat them: the entries of a group would all share a tag and
+ * every one would pass the tag match. Folding the low half in and
+ * multiplying by another odd constant makes the tag depend on all bits.
+ */
+unsigned char swissTag(unsigned hash)
+{
+   return (unsigned char)((((hash ^ (hash >> 16)) * TAG_MULTIPLIER) &
+      0xFFFFFFFFu) >> 25);
+}
+
+#ifdef __SSE2__
+unsigned matchTag(const unsigned char *group, unsigned char tag)
+{
+   __m128i ctrl = _mm_loadu_si128((const __m128i*)group);
+   return (unsigned)_mm_movemask_epi8(
+      _mm_cmpeq_epi8(ctrl, _mm_set1_epi8((char)tag)));
+}
+
+/* EMPTY and DELETED are the control values with the high bit set. */
+unsigned matchFree(const unsigned char *group)
+{
+   return (unsigned)_mm_movemask_epi8(
+      _mm_loadu_si128((const __m128i*)group));
+}
+#else
+unsigned matchTag(const unsigned char *group, unsigned char tag)
+{
+   unsigned i, mask = 0;
+
+   for(i = 0; i < GROUP_SIZE; i++)
+      if(group[i] == tag)
+         mask |= 1u << i;
+   return mask;
+}
+
+unsigned matchFree(const unsigned char *group)
+{
+   unsigned i, mask = 0;
+
+   for(i = 0; i < GROUP_SIZE; i++)
+      if(group[i] & 0x80)
+         mask |= 1u << i;
+   return mask;
+}
+#endif
+
+unsigned matchEmpty(const unsigned char *group)
+{
+   return matchTag(group, CTRL_EMPTY);
+}
+
+unsigned lowestBit(unsigned mask)
+{
+   unsigned i = 0;
+
+   while(!(mask & 1u))
+   {
+      mask >>= 1;
+      i++;
+   }
+   return i;
+}
+
+unsigned homeGroup(void *hashTable, unsigned hash)
+{
+   return getIndex(hashTable, hash) / GROUP_SIZE;
+}
+
+unsigned nextGroup(SwissTable *st, unsigned group)
+{
+   return ++group == st->numGroups ? 0 : group;
+}
+
+unsigned numSwissSlots(SwissTable *st)
+{
+   return st->numGroups * GROUP_SIZE;
+}
+
+void swissAlloc(SwissTable *st)
+{
+   st->numGroups = (htCapacity(st) + GROUP_SIZE - 1) / GROUP_SIZE;
+   st->ctrl = malloc(numSwissSlots(st));
+   st->slots = malloc(numSwissSlots(st) * sizeof(SwissSlot));
+   if(st->ctrl == NULL || st->slots == NULL)
+      mallocError();
+   memset(st->ctrl, CTRL_EMPTY, numSwissSlots(st));
+   st->deleted = 0;
+}
+
+/* Returns the slot index holding the data or -1. */
+long swissFind(SwissTable *st, void *data, unsigned hash)
+{
+   unsigned group = homeGroup(st, hash), probes, mask, i;
+   unsigned char tag = swissTag(hash);
+   const unsigned char *ctrl;
+
+   for(probes = 0; probes < st->numGroups; probes++)
+   {
+      ctrl = st->ctrl + group * GROUP_SIZE;
+      for(mask = matchTag(ctrl, tag); mask; mask &= mask - 1)
+      {
+         i = group * GROUP_SIZE + lowestBit(mask);
+         if(st->slots[i].hash == hash &&
+            dataCompare(st, data, st->slots[i].entry.data) == 0)
+            return (long)i;
+      }
+      if(matchEmpty(ctrl))
+         return -1;
+      group = nextGroup(st, group);
+   }
+   return -1;
+}
+
+/* Returns the first empty or deleted slot along the probe sequence of the
+ * hash. The caller guarantees that there is one.
+ */
+unsigned swissFindEmpty(SwissTable *st, unsigned hash)
+{
+   unsigned group = homeGroup(st, hash), mask;
+
+   while(!(mask = matchFree(st->ctrl + group * GROUP_SIZE)))
+      group = nextGroup(st, group);
+   return group * GROUP_SIZE + lowestBit(mask);
+}
+
+void swissPlace(SwissTable *st, HTEntry entry, unsigned hash)
+{
+   unsigned i = swissFindEmpty(st, hash);
+
+   if(st->ctrl[i] == CTRL_DELETED)
+      st->deleted--;
+   st->ctrl[i] = swissTag(hash);
+   st->slots[i].entry = entry;
+   st->slots[i].hash = hash;
+}
+
+void swissResize(HashTable *ht, unsigned sizeIndex)
+{
+   SwissTable *st = (SwissTable*)ht;
+   unsigned char *oldCtrl = st->ctrl;
+   SwissSlot *oldSlots = st->slots;
+   unsigned i, oldNumSlots = numSwissSlots(st);
+
+   st->base.sizeIndex = sizeIndex;
+   swissAlloc(st);
+   for(i = 0; i < oldNumSlots; i++)
+      if(!(oldCtrl[i] & 0x80))
+         swissPlace(st, oldSlots[i].entry, oldSlots[i].hash);
+   free(oldCtrl);
+   free(oldSlots);
+}
+
+void swissCheckRehash(SwissTable *st)
+{
+   if(needsRehash(&st->base) ||
+      (htUniqueEntries(st) == numSwissSlots(st) &&
+      st->base.numSizes > st->base.sizeIndex + 1))
+      swissResize(&st->base, st->base.sizeIndex + 1);
+   else if(st->deleted && htUniqueEntries(st) + st->deleted >=
+      numSwissSlots(st) - numSwissSlots(st) / 8)
+      swissResize(&st->base, st->base.sizeIndex);
+}
+
+unsigned swissAdd(HashTable *ht, void *data, unsigned hash)
+{
+   SwissTable *st = (SwissTable*)ht;
+   HTEntry entry;
+   long i;
+
+   swissCheckRehash(st);
+
+   if((i = swissFind(st, data, hash)) >= 0)
+      return addDuplicate(ht, &st->slots[i].entry);
+   if(htUniqueEntries(ht) == numSwissSlots(st))
+      tableFullError();
+
+   entry.data = newData(ht, data);
+   entry.frequency = 1;
+   swissPlace(st, entry, hash);
+   entryCount(ht, 1, 1);
+   return 1;
+}
+
+HTEntry swissRemove(HashTable *ht, void *data, unsigned hash,
+   unsigned count)
+{
+   SwissTable *st = (SwissTable*)ht;
+   HTEntry entry;
+   long i;
+
+   entry.data = NULL;
+   entry.frequency = 0;
+   if((i = swissFind(st, data, hash)) < 0)
+      return entry;
+   if(lowerFrequency(ht, &st->slots[i].entry, count))
+   {
+      if(matchEmpty(st->ctrl + i / GROUP_SIZE * GROUP_SIZE))
+         st->ctrl[i] = CTRL_EMPTY;
+      else
+      {
+         st->ctrl[i] = CTRL_DELETED;
+         st->deleted++;
+      }
+   }
+   return st->slots[i].entry;
+}
+
+HTEntry swissLookUp(HashTable *ht, void *data, unsigned hash)
+{
+   SwissTable *st = (SwissTable*)ht;
+   HTEntry entry;
+   long i;
+
+   entry.data = NULL;
+   entry.frequency = 0;
+   if((i = swissFind(st, data, hash)) >= 0)
+      entry = st->slots[i].entry;
+   return entry;
+}
+
+void swissToArray(HashTable *ht, HTEntry *entryArr,
+   unsigned size)
+{
+   SwissTable *st = (SwissTable*)ht;
+   unsigned i, j = 0;
+
+   for(i = 0; j < size && i < numSwissSlots(st); i++)
+      if(!(st->ctrl[i] & 0x80))
+         entryArr[j++] = st->slots[i].entry;
+}
+
+HTEntry* swissIterNext(HashTable *ht, HTIter *iter, unsigned *hash)
+{
+   SwissTable *st = (SwissTable*)ht;
+   unsigned i = iter->position ? iter->bucket + 1 : iter->bucket;
+
+   for(; i < numSwissSlots(st); i++)
+   {
+      if(st->ctrl[i] & 0x80)
+         continue;
+      iter->bucket = i;
+      iter->position = &st->slots[i];
+      if(hash != NULL)
+         *hash = st->slots[i].hash;
+      return &st->slots[i].entry;
+   }
+   iter->bucket = numSwissSlots(st);
+   return NULL;
+}
+
+/* The number of groups a successful lookup of slot i examines. */
+unsigned groupProbes(SwissTable *st, unsigned i)
+{
+   unsigned home = homeGroup(st, st->slots[i].hash);
+   unsigned group = i / GROUP_SIZE;
+
+   if(group >= home)
+      return group - home + 1;
+   return st->numGroups - home + group + 1;
+}
+
+unsigned swissProbeLengths(HashTable *ht, unsigned *counts,
+   unsigned numCounts)
+{
+   SwissTable *st = (SwissTable*)ht;
+   unsigned i, probes, maxProbes = 0;
+
+   for(i = 0; i < numSwissSlots(st); i++)
+   {
+      if(st->ctrl[i] & 0x80)
+         continue;
+      probes = groupProbes(st, i);
+      if(counts != NULL)
+         countProbe(counts, numCounts, probes);
+      if(probes > maxProbes)
+         maxProbes = probes;
+   }
+   return maxProbes;
+}
+
+HTMetrics swissMetrics(HashTable *ht)
+{
+   SwissTable *st = (SwissTable*)ht;
+   HTMetrics metrics;
+   unsigned i;
+   double probes = 0;
+
+   metrics.numberOfChains = htUniqueEntries(ht);
+   metrics.maxChainLength = swissProbeLengths(ht, NULL, 0);
+   metrics.avgChainLength = 0;
+
+   for(i = 0; i < numSwissSlots(st); i++)
+      if(!(st->ctrl[i] & 0x80))
+         probes += groupProbes(st, i);
+   if(metrics.numberOfChains)
+      metrics.avgChainLength = (float)(probes / metrics.numberOfChains);
+   return metrics;
+}
+
+/* A miss reads groups from its home group up to one with an EMPTY slot. A
+ * home slot is the home group of GROUP_SIZE slots (fewer in the last one).
+ */
+double swissMissProbes(HashTable *ht)
+{
+   SwissTable *st = (SwissTable*)ht;
+   unsigned g, group, groups, homes, capacity = htCapacity(ht);
+   double probes = 0;
+
+   for(g = 0; g < st->numGroups; g++)
+   {
+      for(group = g, groups = 1; groups < st->numGroups &&
+         !matchEmpty(st->ctrl + group * GROUP_SIZE); groups++)
+         group = nextGroup(st, group);
+      homes = capacity - g * GROUP_SIZE;
+      probes += (double)groups * (homes < GROUP_SIZE ? homes : GROUP_SIZE);
+   }
+   return probes / capacity;
+}
+
+void swissMemoryUsage(HashTable *ht, HTMemoryUsage *usage,
+   unsigned *allocations)
+{
+   SwissTable *st = (SwissTable*)ht;
+
+   usage->tableBytes += sizeof(SwissTable);
+   usage->bucketBytes += numSwissSlots(st) * (1 + sizeof(SwissSlot));
+   *allocations += 3;
+}
+
+void swissDestroy(HashTable *ht)
+{
+   SwissTable *st = (SwissTable*)ht;
+   unsigned i;
+
+   for(i = 0; i < numSwissSlots(st); i++)
+      if(!(st->ctrl[i] & 0x80))
+         freeData(ht, st->slots[i].entry.data);
+   free(st->ctrl);
+   free(st->slots);
+   freeTable(ht);
+}
+
+void swissPrefetch(HashTable *ht, unsigned hash, int depth)
+{
+   SwissTable *st = (SwissTable*)ht;
+   unsigned group = homeGroup(st, hash);
+
+   if(depth == 0)
+      HT_PREFETCH(st->ctrl + group * GROUP_SIZE);
+   else
+      HT_PREFETCH(st->slots + group * GROUP_SIZE);
+}
+
+const HTEngine swissEngine = {
+   swissAdd,
+   swissLookUp,
+   swissRemove,
+   swissResize,
+   swissPrefetch,
+   swissToArray,
+   swissIterNext,
+   swissMetrics,
+   swissProbeLengths,
+   swissMissProbes,
+   swissMemoryUsage,
+   NULL,
+   swissDestroy
+};
+
+HashTable* swissCreate(HTFunctions *functions, unsigned sizes[],
+   int numSizes, float rehashLoadFactor, const HTOptions *options)
+{
+   SwissTable *st = malloc(sizeof(SwissTable));
+   if(st == NULL)
+      mallocError();
+
+   initTable(&st->base, functions, sizes, numSizes, rehashLoadFactor,
+      options);
+   st->base.engine = &swissEngine;
+   swissAlloc(st);
+   return &st->base;
+}
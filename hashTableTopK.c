@@ -0,0 +1,177 @@
+#include "hashTable.h"
+#include "hashTablePriv.h"
+#include <assert.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+/* Top-K selection. The entries are streamed through a bounded min-heap
+ * whose root is the lowest ranked of the best k seen so far, so a table of
+ * N entries costs O(N log k) compares and no copy of the table. Sorting the
+ * heap in place at the end leaves the entries best first.
+ *
+ * The parallel version gives each worker one contiguous range of buckets
+ * and its own heap, then offers the workers' entries to one final heap.
+ */
+typedef struct
+{
+   HashTable *ht;
+   HTEntry *heap;
+   unsigned size, k;
+} TopHeap;
+
+typedef struct
+{
+   TopHeap heap;
+   unsigned start, end;
+} TopKWorker;
+
+/* Nonzero when a ranks below b: a lower frequency, or the same frequency
+ * and data that FNCompare orders after b's.
+ */
+int ranksBelow(HashTable *ht, HTEntry *a, HTEntry *b)
+{
+   if(a->frequency != b->frequency)
+      return a->frequency < b->frequency;
+   return ht->functions->compare(a->data, b->data) > 0;
+}
+
+void swapEntries(HTEntry *a, HTEntry *b)
+{
+   HTEntry tmp = *a;
+
+   *a = *b;
+   *b = tmp;
+}
+
+void siftUp(TopHeap *h, unsigned i)
+{
+   for(; i > 0 && ranksBelow(h->ht, &h->heap[i], &h->heap[(i - 1) / 2]);
+      i = (i - 1) / 2)
+      swapEntries(&h->heap[i], &h->heap[(i - 1) / 2]);
+}
+
+void siftDown(TopHeap *h, unsigned i)
+{
+   unsigned child;
+
+   while((child = 2 * i + 1) < h->size)
+   {
+      if(child + 1 < h->size &&
+         ranksBelow(h->ht, &h->heap[child + 1], &h->heap[child]))
+         child++;
+      if(!ranksBelow(h->ht, &h->heap[child], &h->heap[i]))
+         return;
+      swapEntries(&h->heap[i], &h->heap[child]);
+      i = child;
+   }
+}
+
+void initHeap(TopHeap *h, HashTable *ht, HTEntry *heap, unsigned k)
+{
+   h->ht = ht;
+   h->heap = heap;
+   h->size = 0;
+   h->k = k;
+}
+
+void offerEntry(TopHeap *h, HTEntry *entry)
+{
+   if(h->size < h->k)
+   {
+      h->heap[h->size] = *entry;
+      siftUp(h, h->size++);
+   }
+   else if(ranksBelow(h->ht, &h->heap[0], entry))
+   {
+      h->heap[0] = *entry;
+      siftDown(h, 0);
+   }
+}
+
+void offerRange(TopHeap *h, unsigned start, unsigned end)
+{
+   HTIter iter;
+   HTEntry *entry;
+
+   htIterBegin(h->ht, &iter, start);
+   while((entry = htIterNext(&iter)) != NULL && iter.bucket < end)
+      offerEntry(h, entry);
+}
+
+/* Heap sorts in place, best first, and returns the number of entries. */
+unsigned sortHeap(TopHeap *h)
+{
+   unsigned count = h->size;
+
+   while(h->size > 1)
+   {
+      swapEntries(&h->heap[0], &h->heap[--h->size]);
+      siftDown(h, 0);
+   }
+   h->size = 0;
+   return count;
+}
+
+unsigned htTopK(void *hashTable, unsigned k, HTEntry out[])
+{
+   TopHeap heap;
+
+   if(k == 0)
+      return 0;
+   initHeap(&heap, hashTable, out, k);
+   offerRange(&heap, 0, UINT_MAX);
+   return sortHeap(&heap);
+}
+
+/* The number of buckets (or slots) a cursor runs over. */
+unsigned iterBuckets(HashTable *ht)
+{
+   HTIter iter;
+
+   htIterBegin(ht, &iter, UINT_MAX);
+   htIterNext(&iter);
+   return iter.bucket;
+}
+
+void* topKWorker(void *arg)
+{
+   TopKWorker *worker = arg;
+
+   offerRange(&worker->heap, worker->start, worker->end);
+   return NULL;
+}
+
+unsigned htTopKParallel(void *hashTable, unsigned k, HTEntry out[],
+   unsigned numThreads)
+{
+   TopKWorker *workers;
+   TopHeap heap;
+   unsigned t, i, buckets = iterBuckets(hashTable);
+
+   assert(numThreads >= 1);
+   if(k == 0)
+      return 0;
+   if((workers = malloc(numThreads * sizeof(TopKWorker))) == NULL)
+      mallocError();
+   for(t = 0; t < numThreads; t++)
+   {
+      workers[t].heap.heap = malloc(k * sizeof(HTEntry));
+      if(workers[t].heap.heap == NULL)
+         mallocError();
+      initHeap(&workers[t].heap, hashTable, workers[t].heap.heap, k);
+      workers[t].start = rangeStart(buckets, t, numThreads);
+      workers[t].end = rangeStart(buckets, t + 1, numThreads);
+   }
+   runWorkers(topKWorker, workers, sizeof(TopKWorker), numThreads);
+
+   initHeap(&heap, hashTable, out, k);
+   for(t = 0; t < numThreads; t++)
+   {
+      for(i = 0; i < workers[t].heap.size; i++)
+         offerEntry(&heap, &workers[t].heap.heap[i]);
+      free(workers[t].heap.heap);
+   }
+   free(workers);
+   return sortHeap(&heap);
+}
@@ -0,0 +1,188 @@
+#include "htHashes.h"
+#include <string.h>
+
+/* The constants and structure of wyhash (final version 4, public domain, by
+ * Wang Yi). Its output is not reproduced bit for bit since only 32 bits are
+ * kept, but the mixing is the same.
+ */
+#define P0 UINT64_C(0x2D358DCCAA6C78A5)
+#define P1 UINT64_C(0x8BB84B93962EACC9)
+#define P2 UINT64_C(0x4B33A62ED433D4A3)
+#define P3 UINT64_C(0x4D5A2DA51DE1AA47)
+
+/* Seed 0 after the initial wyMix(seed ^ P0, P1) of htHashMemory. */
+#define MIXED_SEED0 UINT64_C(0xCA813BF4C7ABF0A9)
+
+#ifdef __SIZEOF_INT128__
+__extension__ typedef unsigned __int128 HTUint128;
+
+/* The 128 bit product of *a and *b, low half in *a and high half in *b. */
+void wyMultiply(uint64_t *a, uint64_t *b)
+{
+   HTUint128 r = (HTUint128)*a * *b;
+
+   *a = (uint64_t)r;
+   *b = (uint64_t)(r >> 64);
+}
+#else
+void wyMultiply(uint64_t *a, uint64_t *b)
+{
+   uint64_t ha = *a >> 32, hb = *b >> 32;
+   uint64_t la = (uint32_t)*a, lb = (uint32_t)*b;
+   uint64_t hi, lo, rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+   uint64_t t = rl + (rm0 << 32), c = t < rl;
+
+   lo = t + (rm1 << 32);
+   c += lo < t;
+   hi = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+   *a = lo;
+   *b = hi;
+}
+#endif
+
+uint64_t wyMix(uint64_t a, uint64_t b)
+{
+   wyMultiply(&a, &b);
+   return a ^ b;
+}
+
+uint64_t wyRead64(const unsigned char *p)
+{
+   uint64_t v;
+
+   memcpy(&v, p, sizeof(v));
+   return v;
+}
+
+uint64_t wyRead32(const unsigned char *p)
+{
+   uint32_t v;
+
+   memcpy(&v, p, sizeof(v));
+   return v;
+}
+
+/* One to three bytes, each of them used. */
+uint64_t wyRead3(const unsigned char *p, size_t len)
+{
+   return ((uint64_t)p[0] << 16) | ((uint64_t)p[len >> 1] << 8) | p[len - 1];
+}
+
+unsigned foldHash(uint64_t h)
+{
+   return (unsigned)(h ^ (h >> 32));
+}
+
+/* 4 to 16 bytes as two overlapping pairs of 32 bit reads. */
+void wyReadShort(const unsigned char *p, size_t len, uint64_t *a, uint64_t *b)
+{
+   size_t step = (len >> 3) << 2;
+
+   *a = (wyRead32(p) << 32) | wyRead32(p + step);
+   *b = (wyRead32(p + len - 4) << 32) | wyRead32(p + len - 4 - step);
+}
+
+/* Consumes all but the last 1 to 16 bytes of a key over 16 bytes long. */
+const unsigned char* wyHashLong(const unsigned char *p, size_t *len,
+   uint64_t *seed)
+{
+   uint64_t see1 = *seed, see2 = *seed;
+
+   if(*len > 48)
+   {
+      do
+      {
+         *seed = wyMix(wyRead64(p) ^ P1, wyRead64(p + 8) ^ *seed);
+         see1 = wyMix(wyRead64(p + 16) ^ P2, wyRead64(p + 24) ^ see1);
+         see2 = wyMix(wyRead64(p + 32) ^ P3, wyRead64(p + 40) ^ see2);
+         p += 48;
+         *len -= 48;
+      } while(*len > 48);
+      *seed ^= see1 ^ see2;
+   }
+   for(; *len > 16; p += 16, *len -= 16)
+      *seed = wyMix(wyRead64(p) ^ P1, wyRead64(p + 8) ^ *seed);
+   return p;
+}
+
+/* The hash of a key given its already mixed seed. */
+unsigned wyHash(const unsigned char *p, size_t len, uint64_t seed)
+{
+   uint64_t a = 0, b = 0;
+   size_t rest = len;
+
+   if(len > 16)
+   {
+      p = wyHashLong(p, &rest, &seed);
+      a = wyRead64(p + rest - 16);
+      b = wyRead64(p + rest - 8);
+   }
+   else if(len >= 4)
+      wyReadShort(p, len, &a, &b);
+   else if(len > 0)
+      a = wyRead3(p, len);
+
+   a ^= P1;
+   b ^= seed;
+   wyMultiply(&a, &b);
+   return foldHash(wyMix(a ^ P0 ^ len, b ^ P1));
+}
+
+unsigned htHashMemory(const void *ptr, size_t len, uint64_t seed)
+{
+   return wyHash(ptr, len, seed ^ wyMix(seed ^ P0, P1));
+}
+
+unsigned htHashString(const void *data)
+{
+   return wyHash(data, strlen(data), MIXED_SEED0);
+}
+
+unsigned htHashBytes(const void *data)
+{
+   const HTBytes *key = data;
+
+   return wyHash(key->ptr, key->len, MIXED_SEED0);
+}
+
+int htCompareBytes(const void *data1, const void *data2)
+{
+   const HTBytes *a = data1, *b = data2;
+   size_t len = a->len < b->len ? a->len : b->len;
+   int cmp = len ? memcmp(a->ptr, b->ptr, len) : 0;
+
+   if(cmp != 0 || a->len == b->len)
+      return cmp;
+   return a->len < b->len ? -1 : 1;
+}
+
+/* lowbias32 by Chris Wellons, found by searching for the lowest bias. */
+unsigned htMix32(unsigned x)
+{
+   x &= 0xFFFFFFFFu;
+   x ^= x >> 16;
+   x = (x * 0x7FEB352Du) & 0xFFFFFFFFu;
+   x ^= x >> 15;
+   x = (x * 0x846CA68Bu) & 0xFFFFFFFFu;
+   return x ^ (x >> 16);
+}
+
+/* The splitmix64 finalizer. */
+unsigned htMix64(uint64_t x)
+{
+   x ^= x >> 30;
+   x *= UINT64_C(0xBF58476D1CE4E5B9);
+   x ^= x >> 27;
+   x *= UINT64_C(0x94D049BB133111EB);
+   return foldHash(x ^ (x >> 31));
+}
+
+unsigned htHashUnsigned(const void *data)
+{
+   return htMix32(*(const unsigned*)data);
+}
+
+unsigned htHashUint64(const void *data)
+{
+   return htMix64(*(const uint64_t*)data);
+}
@@ -0,0 +1,71 @@
+/* Ready-made FNHash functions. Any of them can be put in HTFunctions next to
+ * a matching FNCompare, for example {htHashBytes, htCompareBytes, NULL}.
+ *
+ * The string hashes follow wyhash: 16 bytes are consumed per multiply (48
+ * per step of three independent multiplies for long keys) using a 64x64 to
+ * 128 bit multiply, and the result is folded to the 32 bits FNHash returns.
+ * Unaligned loads are done with memcpy, so keys may start at any address.
+ * The values differ between little and big endian machines.
+ */
+#ifndef HTHASHES_H
+#define HTHASHES_H
+
+#include "hashTable.h"
+#include <stddef.h>
+#include <stdint.h>
+
+/* A key that is not NUL terminated or may contain NUL bytes. The table
+ * stores (and frees) the HTBytes itself, so ptr usually points into the same
+ * allocation, just past the struct.
+ */
+typedef struct
+{
+   const void *ptr;
+   size_t len;
+} HTBytes;
+
+/* Description: Hashes len bytes starting at ptr.
+ *
+ * Parameters:
+ *    ptr: The first byte, need not be aligned. May be NULL if len is 0.
+ *    len: The number of bytes.
+ *    seed: Any value, different seeds give unrelated hashes.
+ *
+ * Return: The hash.
+ */
+unsigned htHashMemory(const void *ptr, size_t len, uint64_t seed);
+
+/* Description: FNHash for NUL terminated strings.
+ *
+ * Return: htHashMemory of the characters before the NUL with seed 0.
+ */
+unsigned htHashString(const void *data);
+
+/* Description: FNHash for HTBytes keys, use with htCompareBytes.
+ *
+ * Return: htHashMemory of the bytes with seed 0, so equal to htHashString
+ *    of the same characters.
+ */
+unsigned htHashBytes(const void *data);
+
+/* Description: FNCompare for HTBytes keys. Orders like memcmp with a
+ *    shorter key ordered before a longer one it is a prefix of.
+ */
+int htCompareBytes(const void *data1, const void *data2);
+
+/* Description: Invertible integer mixers. Every bit of the input affects
+ *    every bit of the output, so keys that differ only in their high bits
+ *    (or form a sequence) still spread over all buckets.
+ *
+ * Return: The mixed value, htMix64 folded to 32 bits.
+ */
+unsigned htMix32(unsigned x);
+unsigned htMix64(uint64_t x);
+
+/* Description: FNHash for unsigned and uint64_t keys, data points to the
+ *    key.
+ */
+unsigned htHashUnsigned(const void *data);
+unsigned htHashUint64(const void *data);
+
+#endif
@@ -0,0 +1,392 @@
+/* A header-only C++17 counterpart of the chaining engine in hashTable.c.
+ *
+ * semi::HashTable keeps the same algorithm and semantics as htCreate's
+ * tables: separate chaining with cached hashes, new keys appended to the
+ * tail of their chain, add() counting how often a key has been added, and
+ * growth through the caller's sizes when the unique entries exceed the
+ * rehash load factor, relinking the chains in order. What changes is that
+ * Hash and Eq are compile-time functors, so every hash and every chain
+ * compare can be inlined instead of going through the FNHash and FNCompare
+ * pointers, and that the table owns its keys (RAII, move-only).
+ *
+ * Requires C++17. Nothing needs to be linked.
+ */
+#ifndef SEMIHASHTABLE_HPP
+#define SEMIHASHTABLE_HPP
+
+#include <cassert>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <new>
+#include <utility>
+#include <vector>
+
+namespace semi {
+
+/* The same three numbers as the C interface's HTMetrics. */
+struct Metrics
+{
+   unsigned numberOfChains;
+   unsigned maxChainLength;
+   float avgChainLength;
+};
+
+template <class Key, class Hash = std::hash<Key>,
+   class Eq = std::equal_to<Key>, class Alloc = std::allocator<Key>>
+class HashTable
+{
+public:
+   /* The counterpart of HTEntry: the stored key and how often it was added. */
+   struct Entry
+   {
+      Key key;
+      unsigned frequency;
+   };
+
+   /* The counterpart of htCreate. sizes must be ascending and nonzero and
+    * 0 < rehashLoadFactor <= 1, where 1 means never grow (asserted).
+    */
+   HashTable(std::vector<unsigned> sizes, float rehashLoadFactor,
+      const Hash &hash = Hash(), const Eq &eq = Eq(),
+      const Alloc &alloc = Alloc())
+      : sizes_(std::move(sizes)), rehashLoadFactor_(rehashLoadFactor),
+        hash_(hash), eq_(eq), nodeAlloc_(alloc), bucketAlloc_(alloc)
+   {
+      assert(!sizes_.empty() && sizes_[0] != 0);
+      for (std::size_t i = 1; i < sizes_.size(); i++)
+         assert(sizes_[i - 1] < sizes_[i]);
+      assert(rehashLoadFactor > 0 && rehashLoadFactor <= 1);
+      buckets_ = allocBuckets(sizes_[0]);
+   }
+
+   HashTable(const HashTable&) = delete;
+   HashTable& operator=(const HashTable&) = delete;
+
+   /* A moved-from table may only be destroyed or assigned to. */
+   HashTable(HashTable &&other) noexcept
+      : sizes_(std::move(other.sizes_)), sizeIndex_(other.sizeIndex_),
+        rehashLoadFactor_(other.rehashLoadFactor_),
+        totalEntries_(other.totalEntries_),
+        uniqueEntries_(other.uniqueEntries_), buckets_(other.buckets_),
+        hash_(std::move(other.hash_)), eq_(std::move(other.eq_)),
+        nodeAlloc_(std::move(other.nodeAlloc_)),
+        bucketAlloc_(std::move(other.bucketAlloc_))
+   {
+      other.buckets_ = nullptr;
+   }
+
+   HashTable& operator=(HashTable &&other) noexcept
+   {
+      swap(other);
+      return *this;
+   }
+
+   ~HashTable()
+   {
+      if (buckets_ == nullptr)
+         return;
+      for (unsigned i = 0; i < capacity(); i++)
+         freeChain(buckets_[i]);
+      BucketTraits::deallocate(bucketAlloc_, buckets_, capacity());
+   }
+
+   /* Every member, allocators included, moves with the nodes and buckets
+    * they allocated.
+    */
+   void swap(HashTable &other) noexcept
+   {
+      using std::swap;
+      swap(sizes_, other.sizes_);
+      swap(sizeIndex_, other.sizeIndex_);
+      swap(rehashLoadFactor_, other.rehashLoadFactor_);
+      swap(totalEntries_, other.totalEntries_);
+      swap(uniqueEntries_, other.uniqueEntries_);
+      swap(buckets_, other.buckets_);
+      swap(hash_, other.hash_);
+      swap(eq_, other.eq_);
+      swap(nodeAlloc_, other.nodeAlloc_);
+      swap(bucketAlloc_, other.bucketAlloc_);
+   }
+
+   /* The counterpart of htAdd: stores a copy of (or moves) the key if it
+    * is new and returns its frequency after the add.
+    */
+   unsigned add(const Key &key)
+   {
+      return addKey(key);
+   }
+
+   unsigned add(Key &&key)
+   {
+      return addKey(std::move(key));
+   }
+
+   /* Like add, but constructs the key from args directly in the storage of
+    * a new node. If the key turns out to be present already the node is
+    * destroyed again.
+    */
+   template <class... Args>
+   unsigned emplace(Args&&... args)
+   {
+      Node *node = newNode(std::forward<Args>(args)...), *found;
+      Node **link;
+
+      try
+      {
+         checkRehash();
+         node->hash = hash_(node->entry.key);
+         link = &buckets_[index(node->hash)];
+         found = find(link, node->entry.key, node->hash);
+      }
+      catch (...)
+      {
+         freeNode(node);
+         throw;
+      }
+      if (found)
+      {
+         freeNode(node);
+         totalEntries_++;
+         return ++found->entry.frequency;
+      }
+      *link = node;
+      totalEntries_++;
+      uniqueEntries_++;
+      return 1;
+   }
+
+   /* The counterpart of htLookUp: the entry for the key or nullptr. */
+   const Entry* lookUp(const Key &key) const
+   {
+      std::size_t h = hash_(key);
+      Node *const *link = &buckets_[index(h)];
+
+      for (; *link; link = &(*link)->next)
+         if ((*link)->hash == h && eq_((*link)->entry.key, key))
+            return &(*link)->entry;
+      return nullptr;
+   }
+
+   unsigned frequency(const Key &key) const
+   {
+      const Entry *entry = lookUp(key);
+
+      return entry ? entry->frequency : 0;
+   }
+
+   /* The counterpart of htToArray: every entry in bucket and chain order. */
+   std::vector<const Entry*> toArray() const
+   {
+      std::vector<const Entry*> entries;
+
+      entries.reserve(uniqueEntries_);
+      forEach([&entries](const Entry &entry) { entries.push_back(&entry); });
+      return entries;
+   }
+
+   /* Calls visit(const Entry&) for every entry in toArray's order. */
+   template <class Visit>
+   void forEach(Visit &&visit) const
+   {
+      for (unsigned i = 0; i < capacity(); i++)
+         for (const Node *node = buckets_[i]; node; node = node->next)
+            visit(node->entry);
+   }
+
+   unsigned capacity() const
+   {
+      return sizes_[sizeIndex_];
+   }
+
+   unsigned uniqueEntries() const
+   {
+      return uniqueEntries_;
+   }
+
+   unsigned totalEntries() const
+   {
+      return totalEntries_;
+   }
+
+   /* The counterpart of htMetrics (avgChainLength is 0 when empty). */
+   Metrics metrics() const
+   {
+      Metrics metrics = {0, 0, 0};
+      unsigned length;
+
+      for (unsigned i = 0; i < capacity(); i++)
+      {
+         if (buckets_[i] == nullptr)
+            continue;
+         metrics.numberOfChains++;
+         length = 0;
+         for (const Node *node = buckets_[i]; node; node = node->next)
+            length++;
+         if (length > metrics.maxChainLength)
+            metrics.maxChainLength = length;
+      }
+      if (metrics.numberOfChains)
+         metrics.avgChainLength = (float)uniqueEntries_ /
+            (float)metrics.numberOfChains;
+      return metrics;
+   }
+
+private:
+   struct Node
+   {
+      template <class... Args>
+      explicit Node(Args&&... args)
+         : next(nullptr), hash(0),
+           entry{Key(std::forward<Args>(args)...), 1u}
+      {
+      }
+
+      Node *next;
+      std::size_t hash;
+      Entry entry;
+   };
+
+   using NodeAlloc =
+      typename std::allocator_traits<Alloc>::template rebind_alloc<Node>;
+   using NodeTraits = std::allocator_traits<NodeAlloc>;
+   using BucketAlloc =
+      typename std::allocator_traits<Alloc>::template rebind_alloc<Node*>;
+   using BucketTraits = std::allocator_traits<BucketAlloc>;
+
+   Node** allocBuckets(unsigned size)
+   {
+      Node **buckets = BucketTraits::allocate(bucketAlloc_, size);
+
+      for (unsigned i = 0; i < size; i++)
+         buckets[i] = nullptr;
+      return buckets;
+   }
+
+   template <class... Args>
+   Node* newNode(Args&&... args)
+   {
+      Node *node = NodeTraits::allocate(nodeAlloc_, 1);
+
+      try
+      {
+         NodeTraits::construct(nodeAlloc_, node, std::forward<Args>(args)...);
+      }
+      catch (...)
+      {
+         NodeTraits::deallocate(nodeAlloc_, node, 1);
+         throw;
+      }
+      return node;
+   }
+
+   void freeNode(Node *node)
+   {
+      NodeTraits::destroy(nodeAlloc_, node);
+      NodeTraits::deallocate(nodeAlloc_, node, 1);
+   }
+
+   void freeChain(Node *node)
+   {
+      Node *next;
+
+      for (; node; node = next)
+      {
+         next = node->next;
+         freeNode(node);
+      }
+   }
+
+   unsigned index(std::size_t hash) const
+   {
+      return (unsigned)(hash % capacity());
+   }
+
+   /* Returns the matching node, or nullptr with *link left at the chain's
+    * terminating null pointer, where a new node belongs.
+    */
+   Node* find(Node **&link, const Key &key, std::size_t hash) const
+   {
+      for (; *link; link = &(*link)->next)
+         if ((*link)->hash == hash && eq_((*link)->entry.key, key))
+            return *link;
+      return nullptr;
+   }
+
+   template <class K>
+   unsigned addKey(K &&key)
+   {
+      std::size_t h;
+      Node **link;
+
+      checkRehash();
+      h = hash_(key);
+      link = &buckets_[index(h)];
+      if (Node *found = find(link, key, h))
+      {
+         totalEntries_++;
+         return ++found->entry.frequency;
+      }
+      *link = newNode(std::forward<K>(key));
+      (*link)->hash = h;
+      totalEntries_++;
+      uniqueEntries_++;
+      return 1;
+   }
+
+   /* needsRehash in hashTable.c. */
+   void checkRehash()
+   {
+      if (sizes_.size() > sizeIndex_ + 1 && rehashLoadFactor_ != 1 &&
+         rehashLoadFactor_ < (float)uniqueEntries_ / (float)capacity())
+         rehash();
+   }
+
+   /* Moves every node to the tail of its new chain, old buckets in order,
+    * so chains keep their relative order as in rePopulate.
+    */
+   void rehash()
+   {
+      unsigned oldSize = capacity(), newSize = sizes_[sizeIndex_ + 1];
+      Node **newBuckets = allocBuckets(newSize), **oldBuckets = buckets_;
+      std::vector<Node**> tails(newSize);
+      Node *node, *next;
+      unsigned i, j;
+
+      for (j = 0; j < newSize; j++)
+         tails[j] = &newBuckets[j];
+      for (i = 0; i < oldSize; i++)
+         for (node = oldBuckets[i]; node; node = next)
+         {
+            next = node->next;
+            j = (unsigned)(node->hash % newSize);
+            node->next = nullptr;
+            *tails[j] = node;
+            tails[j] = &node->next;
+         }
+      buckets_ = newBuckets;
+      sizeIndex_++;
+      BucketTraits::deallocate(bucketAlloc_, oldBuckets, oldSize);
+   }
+
+   std::vector<unsigned> sizes_;
+   std::size_t sizeIndex_ = 0;
+   float rehashLoadFactor_;
+   unsigned totalEntries_ = 0, uniqueEntries_ = 0;
+   Node **buckets_ = nullptr;
+   Hash hash_;
+   Eq eq_;
+   NodeAlloc nodeAlloc_;
+   BucketAlloc bucketAlloc_;
+};
+
+template <class Key, class Hash, class Eq, class Alloc>
+void swap(HashTable<Key, Hash, Eq, Alloc> &a,
+   HashTable<Key, Hash, Eq, Alloc> &b) noexcept
+{
+   a.swap(b);
+}
+
+} /* namespace semi */
+
+#endif
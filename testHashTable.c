@@ -14,8 +14,12 @@
 #include <assert.h>
 #include <limits.h>
 #include <float.h>
+#include <math.h>
+#include <pthread.h>
 #include "unitTest.h"
 #include "hashTable.h"
+#include "hashTableEx.h"
+#include "htHashes.h"
 
 #define TEST_ALL -1
 #define REGULAR -2 
@@ -1135,6 +1139,1923 @@ static void feat13()
                                                                                                                                                                                                                                          free(sizeList);
                                                                                                                                                                                                                                             htDestroy(ht);
 }
+static unsigned hashCalls, compareCalls;
+
+static unsigned hashCounted(const void *data)
+{
+   hashCalls++;
+   return hashString(data);
+}
+
+static int compareCounted(const void *a, const void *b)
+{
+   compareCalls++;
+   return strcmp(a, b);
+}
+
+/* Every key lands in bucket 0 of a 7 bucket table but with a distinct full
+ * hash value.
+ */
+static unsigned hashSeventh(const void *data)
+{
+   return 7 * (unsigned)*(const char*)data;
+}
+
+static void feat14()
+{
+   int i;
+   unsigned sizes[] = {3, 7, 17, 31};
+   HTFunctions funcs = {hashCounted, compareString, NULL};
+   void *ht = htCreate(&funcs, sizes, 4, 0.5);
+   char *str;
+
+   hashCalls = 0;
+   for (i = 0; i < 12; i++)
+   {
+      str = malloc(2);
+      str[0] = 'a' + i;
+      str[1] = 0;
+      htAdd(ht, str);
+   }
+
+   TEST_UNSIGNED(htCapacity(ht), 31);
+   TEST_UNSIGNED(htUniqueEntries(ht), 12);
+   TEST_UNSIGNED(hashCalls, 12);
+
+   for (i = 0; i < 12; i++)
+   {
+      char key[2];
+      key[0] = 'a' + i;
+      key[1] = 0;
+      TEST_UNSIGNED(htLookUp(ht, key).frequency, 1);
+   }
+
+   htDestroy(ht);
+}
+
+static void feat15()
+{
+   unsigned sizes[] = {7};
+   HTFunctions funcs = {hashSeventh, compareCounted, NULL};
+   void *ht = htCreate(&funcs, sizes, 1, 1.0);
+   HTMetrics metrics;
+   char *str1 = malloc(2);
+   char *str2 = malloc(2);
+   char *str3 = malloc(2);
+
+   strcpy(str1, "a");
+   strcpy(str2, "b");
+   strcpy(str3, "c");
+
+   compareCalls = 0;
+   htAdd(ht, str1);
+   htAdd(ht, str2);
+   htAdd(ht, str3);
+   TEST_UNSIGNED(compareCalls, 0);
+
+   metrics = htMetrics(ht);
+   TEST_UNSIGNED(metrics.numberOfChains, 1);
+   TEST_UNSIGNED(metrics.maxChainLength, 3);
+
+   TEST_UNSIGNED(htLookUp(ht, "c").frequency, 1);
+   TEST_UNSIGNED(compareCalls, 1);
+   TEST_BOOLEAN(htLookUp(ht, "d").data == NULL, 1);
+   TEST_UNSIGNED(compareCalls, 1);
+
+   htDestroy(ht);
+}
+
+static void feat16()
+{
+   int i;
+   unsigned size = 0;
+   unsigned sizes[] = {5, 11, 23};
+   HTFunctions funcs = {hashString, compareString, NULL};
+   HTOptions options;
+   void *ht;
+   HTEntry *entries;
+   char *str, *dup = malloc(2);
+
+   htDefaultOptions(&options);
+   options.engine = HT_ENGINE_ROBIN_HOOD;
+   ht = htCreateEx(&funcs, sizes, 3, 0.73, &options);
+
+   for (i = 0; i < 10; i++)
+   {
+      str = malloc(2);
+      str[0] = 'a' + i;
+      str[1] = 0;
+      TEST_UNSIGNED(htAdd(ht, str), 1);
+   }
+   strcpy(dup, "c");
+   TEST_UNSIGNED(htAdd(ht, dup), 2);
+   free(dup);
+
+   TEST_UNSIGNED(htCapacity(ht), 23);
+   TEST_UNSIGNED(htUniqueEntries(ht), 10);
+   TEST_UNSIGNED(htTotalEntries(ht), 11);
+   TEST_UNSIGNED(htLookUp(ht, "c").frequency, 2);
+   TEST_UNSIGNED(htLookUp(ht, "j").frequency, 1);
+   TEST_BOOLEAN(htLookUp(ht, "k").data == NULL, 1);
+
+   entries = htToArray(ht, &size);
+   TEST_UNSIGNED(size, 10);
+   for (i = 0; i < 10; i++)
+      TEST_UNSIGNED(htLookUp(ht, entries[i].data).frequency,
+         entries[i].frequency);
+
+   free(entries);
+   htDestroy(ht);
+}
+
+static void feat17()
+{
+   unsigned counts[4];
+   unsigned sizes[] = {7};
+   HTFunctions funcs = {hashSeventh, compareString, NULL};
+   HTOptions options;
+   HTMetrics metrics;
+   void *ht;
+   char *str1 = malloc(2);
+   char *str2 = malloc(2);
+   char *str3 = malloc(2);
+
+   htDefaultOptions(&options);
+   options.engine = HT_ENGINE_ROBIN_HOOD;
+   ht = htCreateEx(&funcs, sizes, 1, 1.0, &options);
+
+   strcpy(str1, "a");
+   strcpy(str2, "b");
+   strcpy(str3, "c");
+   htAdd(ht, str1);
+   htAdd(ht, str2);
+   htAdd(ht, str3);
+
+   metrics = htMetrics(ht);
+   TEST_UNSIGNED(metrics.numberOfChains, 3);
+   TEST_UNSIGNED(metrics.maxChainLength, 3);
+   TEST_REAL(metrics.avgChainLength, 2.0, FLT_EPSILON);
+
+   TEST_UNSIGNED(htProbeLengths(ht, counts, 4), 3);
+   TEST_UNSIGNED(counts[0], 1);
+   TEST_UNSIGNED(counts[1], 1);
+   TEST_UNSIGNED(counts[2], 1);
+   TEST_UNSIGNED(counts[3], 0);
+
+   TEST_UNSIGNED(htLookUp(ht, "c").frequency, 1);
+   TEST_BOOLEAN(htLookUp(ht, "d").data == NULL, 1);
+
+   htDestroy(ht);
+}
+
+/* The home group comes from the high bits of the hash here, yet a lookup
+ * only calls FNCompare on the entry it is looking for.
+ */
+static void swissHighBits(HTIndexMode indexMode)
+{
+   unsigned sizes[] = {2048};
+   HTFunctions funcs = {hashCounted, compareCounted, NULL};
+   HTOptions options;
+   void *ht;
+   char buf[16], *str;
+   unsigned i;
+
+   htDefaultOptions(&options);
+   options.engine = HT_ENGINE_SWISS;
+   options.indexMode = indexMode;
+   ht = htCreateEx(&funcs, sizes, 1, 0.9f, &options);
+   for (i = 0; i < 1500; i++)
+   {
+      sprintf(buf, "key%u", i);
+      str = malloc(strlen(buf) + 1);
+      strcpy(str, buf);
+      htAdd(ht, str);
+   }
+
+   compareCalls = 0;
+   for (i = 0; i < 1500; i++)
+   {
+      sprintf(buf, "key%u", i);
+      TEST_UNSIGNED(htLookUp(ht, buf).frequency, 1);
+      sprintf(buf, "miss%u", i);
+      TEST_BOOLEAN(htLookUp(ht, buf).data == NULL, 1);
+   }
+   TEST_UNSIGNED(compareCalls, 1500);
+   htDestroy(ht);
+}
+
+static void feat18()
+{
+   int i;
+   unsigned size = 0;
+   unsigned sizes[] = {7, 37, 131};
+   HTFunctions funcs = {hashSeventh, compareCounted, NULL};
+   HTOptions options;
+   HTMetrics metrics;
+   HTEntry *entries;
+   void *ht;
+   char *str, *dup = malloc(2);
+
+   htDefaultOptions(&options);
+   options.engine = HT_ENGINE_SWISS;
+   ht = htCreateEx(&funcs, sizes, 3, 0.73, &options);
+
+   compareCalls = 0;
+   for (i = 0; i < 26; i++)
+   {
+      str = malloc(2);
+      str[0] = 'a' + i;
+      str[1] = 0;
+      TEST_UNSIGNED(htAdd(ht, str), 1);
+   }
+   TEST_UNSIGNED(compareCalls, 0);
+
+   strcpy(dup, "q");
+   TEST_UNSIGNED(htAdd(ht, dup), 2);
+   free(dup);
+
+   TEST_UNSIGNED(htCapacity(ht), 37);
+   TEST_UNSIGNED(htUniqueEntries(ht), 26);
+   TEST_UNSIGNED(htTotalEntries(ht), 27);
+   TEST_UNSIGNED(htLookUp(ht, "q").frequency, 2);
+   TEST_UNSIGNED(htLookUp(ht, "z").frequency, 1);
+   TEST_BOOLEAN(htLookUp(ht, "A").data == NULL, 1);
+
+   entries = htToArray(ht, &size);
+   TEST_UNSIGNED(size, 26);
+   for (i = 0; i < 26; i++)
+      TEST_UNSIGNED(htLookUp(ht, entries[i].data).frequency,
+         entries[i].frequency);
+   free(entries);
+
+   metrics = htMetrics(ht);
+   TEST_UNSIGNED(metrics.numberOfChains, 26);
+   TEST_BOOLEAN(metrics.maxChainLength >= 1, 1);
+
+   htDestroy(ht);
+   swissHighBits(HT_INDEX_MULTIPLY_SHIFT);
+   swissHighBits(HT_INDEX_FIBONACCI);
+}
+
+static void feat19()
+{
+   int i;
+   unsigned j, freq, size = 0;
+   unsigned sizes[] = {3, 11, 41, 163, 653};
+   HTFunctions funcs = {hashString, compareString, NULL};
+   HTOptions options;
+   HTEntry *entries;
+   void *ht, *ref;
+   char *str, *refStr;
+
+   htDefaultOptions(&options);
+   options.incrementalRehash = 1;
+   ht = htCreateEx(&funcs, sizes, 5, 0.73, &options);
+   ref = htCreate(&funcs, sizes, 5, 0.73);
+
+   for (i = 0; i < 400; i++)
+   {
+      str = randomString();
+      refStr = malloc(strlen(str) + 1);
+      strcpy(refStr, str);
+      freq = htAdd(ht, str);
+      TEST_UNSIGNED(freq, htAdd(ref, refStr));
+      TEST_UNSIGNED(htCapacity(ht), htCapacity(ref));
+      if (freq > 1)
+      {
+         free(str);
+         free(refStr);
+      }
+
+      /* Every entry stays reachable while buckets are being migrated */
+      entries = htToArray(ref, &size);
+      for (j = 0; j < size; j += 17)
+         TEST_UNSIGNED(htLookUp(ht, entries[j].data).frequency,
+            entries[j].frequency);
+      free(entries);
+   }
+
+   TEST_UNSIGNED(htUniqueEntries(ht), htUniqueEntries(ref));
+   TEST_UNSIGNED(htTotalEntries(ht), htTotalEntries(ref));
+   entries = htToArray(ht, &size);
+   TEST_UNSIGNED(size, htUniqueEntries(ref));
+   free(entries);
+
+   htDestroy(ht);
+   htDestroy(ref);
+}
+
+static void feat20()
+{
+   int i;
+   unsigned j, freq, size = 0, sizeSer = 0;
+   unsigned sizes[] = {31, 1021, 16381, 65521};
+   HTFunctions funcs = {hashString, compareString, NULL};
+   HTOptions options;
+   HTEntry *entries, *entriesSer;
+   void *ht, *ref;
+   char *str, *refStr;
+
+   htDefaultOptions(&options);
+   options.rehashThreads = 4;
+   ht = htCreateEx(&funcs, sizes, 4, 0.73, &options);
+   ref = htCreate(&funcs, sizes, 4, 0.73);
+
+   for (i = 0; i < 20000; i++)
+   {
+      str = randomString();
+      refStr = malloc(strlen(str) + 1);
+      strcpy(refStr, str);
+      freq = htAdd(ht, str);
+      TEST_UNSIGNED(freq, htAdd(ref, refStr));
+      if (freq > 1)
+      {
+         free(str);
+         free(refStr);
+      }
+   }
+   TEST_UNSIGNED(htCapacity(ht), 65521);
+   TEST_UNSIGNED(htCapacity(ht), htCapacity(ref));
+
+   /* Same chains in the same order as the serial rehash */
+   entries = htToArray(ht, &size);
+   entriesSer = htToArray(ref, &sizeSer);
+   TEST_UNSIGNED(size, sizeSer);
+   for (j = 0; j < size; j++)
+      TEST_BOOLEAN(strcmp(entries[j].data, entriesSer[j].data) == 0, 1);
+   free(entries);
+   free(entriesSer);
+
+   htDestroy(ht);
+   htDestroy(ref);
+}
+
+/* Fills a table created with the options with the same random strings as a
+ * default table and checks they agree. With sameOrder the tables must also
+ * produce the same htToArray order, i.e., compute the same bucket indexes.
+ */
+static void compareIndexMode(HTOptions *options, unsigned sizes[],
+   int numSizes, int sameOrder)
+{
+   int i;
+   unsigned j, freq, size = 0, refSize = 0;
+   HTFunctions funcs = {hashString, compareString, NULL};
+   HTEntry *entries, *refEntries;
+   void *ht = htCreateEx(&funcs, sizes, numSizes, 0.73, options);
+   void *ref = htCreate(&funcs, sizes, numSizes, 0.73);
+   char *str, *refStr;
+
+   for (i = 0; i < 3000; i++)
+   {
+      str = randomString();
+      refStr = malloc(strlen(str) + 1);
+      strcpy(refStr, str);
+      freq = htAdd(ht, str);
+      TEST_UNSIGNED(freq, htAdd(ref, refStr));
+      if (freq > 1)
+      {
+         free(str);
+         free(refStr);
+      }
+   }
+   TEST_UNSIGNED(htCapacity(ht), htCapacity(ref));
+   TEST_UNSIGNED(htUniqueEntries(ht), htUniqueEntries(ref));
+
+   entries = htToArray(ht, &size);
+   refEntries = htToArray(ref, &refSize);
+   TEST_UNSIGNED(size, refSize);
+   for (j = 0; j < size; j++)
+   {
+      TEST_UNSIGNED(htLookUp(ht, refEntries[j].data).frequency,
+         refEntries[j].frequency);
+      if (sameOrder)
+         TEST_BOOLEAN(strcmp(entries[j].data, refEntries[j].data) == 0, 1);
+   }
+   free(entries);
+   free(refEntries);
+
+   htDestroy(ht);
+   htDestroy(ref);
+}
+
+static void feat21()
+{
+   unsigned primes[] = {1, 7, 131, 1031, 4099};
+   unsigned powers[] = {1, 8, 128, 1024, 4096};
+   HTOptions options;
+
+   htDefaultOptions(&options);
+   options.indexMode = HT_INDEX_RECIPROCAL;
+   compareIndexMode(&options, primes, 5, 1);
+
+   options.indexMode = HT_INDEX_MULTIPLY_SHIFT;
+   compareIndexMode(&options, primes, 5, 0);
+
+   options.indexMode = HT_INDEX_FIBONACCI;
+   compareIndexMode(&options, powers, 5, 0);
+
+   options.engine = HT_ENGINE_SWISS;
+   compareIndexMode(&options, powers, 5, 0);
+
+   options.engine = HT_ENGINE_ROBIN_HOOD;
+   options.indexMode = HT_INDEX_RECIPROCAL;
+   compareIndexMode(&options, primes, 5, 0);
+}
+
+/* Adds "a", "b" and "c" (in that order) to a table with a single chain. */
+static void *createAbcChain(HTChainOrder chainOrder)
+{
+   unsigned sizes[] = {7};
+   HTFunctions funcs = {hashBad, compareCounted, NULL};
+   HTOptions options;
+   void *ht;
+   char *str1 = malloc(2);
+   char *str2 = malloc(2);
+   char *str3 = malloc(2);
+
+   htDefaultOptions(&options);
+   options.chainOrder = chainOrder;
+   ht = htCreateEx(&funcs, sizes, 1, 1.0, &options);
+
+   strcpy(str1, "a");
+   strcpy(str2, "b");
+   strcpy(str3, "c");
+   htAdd(ht, str1);
+   htAdd(ht, str2);
+   htAdd(ht, str3);
+   return ht;
+}
+
+static void feat22()
+{
+   void *ht = createAbcChain(HT_CHAIN_INSERTION);
+   char *dup = malloc(2);
+
+   /* The search stops at the first match */
+   strcpy(dup, "a");
+   compareCalls = 0;
+   TEST_UNSIGNED(htAdd(ht, dup), 2);
+   TEST_UNSIGNED(compareCalls, 1);
+   free(dup);
+
+   compareCalls = 0;
+   TEST_UNSIGNED(htLookUp(ht, "b").frequency, 1);
+   TEST_UNSIGNED(compareCalls, 2);
+
+   compareCalls = 0;
+   TEST_UNSIGNED(htLookUp(ht, "c").frequency, 1);
+   TEST_UNSIGNED(htLookUp(ht, "c").frequency, 1);
+   TEST_UNSIGNED(compareCalls, 6);
+
+   htDestroy(ht);
+}
+
+static void feat23()
+{
+   unsigned size;
+   HTEntry *entries;
+   void *ht = createAbcChain(HT_CHAIN_MOVE_TO_FRONT);
+   char *dup = malloc(2);
+
+   compareCalls = 0;
+   TEST_UNSIGNED(htLookUp(ht, "c").frequency, 1);
+   TEST_UNSIGNED(compareCalls, 3);
+   compareCalls = 0;
+   TEST_UNSIGNED(htLookUp(ht, "c").frequency, 1);
+   TEST_UNSIGNED(compareCalls, 1);
+
+   strcpy(dup, "b");
+   TEST_UNSIGNED(htAdd(ht, dup), 2);
+   free(dup);
+
+   entries = htToArray(ht, &size);
+   TEST_UNSIGNED(size, 3);
+   TEST_STRING(entries[0].data, "b");
+   TEST_STRING(entries[1].data, "c");
+   TEST_STRING(entries[2].data, "a");
+   free(entries);
+
+   htDestroy(ht);
+}
+
+static void feat24()
+{
+   unsigned size;
+   HTEntry *entries;
+   void *ht = createAbcChain(HT_CHAIN_BY_FREQUENCY);
+   char *dup1 = malloc(2);
+   char *dup2 = malloc(2);
+   char *dup3 = malloc(2);
+
+   /* Lookups do not change frequencies so nothing moves */
+   TEST_UNSIGNED(htLookUp(ht, "c").frequency, 1);
+
+   strcpy(dup1, "c");
+   strcpy(dup2, "b");
+   strcpy(dup3, "c");
+   TEST_UNSIGNED(htAdd(ht, dup1), 2);
+   TEST_UNSIGNED(htAdd(ht, dup2), 2);
+   TEST_UNSIGNED(htAdd(ht, dup3), 3);
+   free(dup1);
+   free(dup2);
+   free(dup3);
+
+   compareCalls = 0;
+   TEST_UNSIGNED(htLookUp(ht, "c").frequency, 3);
+   TEST_UNSIGNED(compareCalls, 1);
+
+   entries = htToArray(ht, &size);
+   TEST_UNSIGNED(size, 3);
+   TEST_STRING(entries[0].data, "c");
+   TEST_STRING(entries[1].data, "b");
+   TEST_STRING(entries[2].data, "a");
+   free(entries);
+
+   htDestroy(ht);
+}
+
+static void batchEngine(HTEngineType engine)
+{
+   int i;
+   unsigned freqs[100];
+   unsigned sizes[] = {7, 31, 131, 521};
+   HTFunctions funcs = {hashString, compareString, NULL};
+   HTOptions options;
+   HTEntry entries[100];
+   void *data[100], *keys[100];
+   void *ht, *ref;
+   char *refStr;
+
+   htDefaultOptions(&options);
+   options.engine = engine;
+   ht = htCreateEx(&funcs, sizes, 4, 0.73, &options);
+   ref = htCreate(&funcs, sizes, 4, 0.73);
+
+   /* Only 60 distinct keys so a third of the batch are duplicates */
+   for (i = 0; i < 100; i++)
+   {
+      data[i] = malloc(8);
+      sprintf(data[i], "k%d", i % 60);
+   }
+   htAddBatch(ht, data, 100, freqs);
+
+   for (i = 0; i < 100; i++)
+   {
+      refStr = malloc(8);
+      strcpy(refStr, data[i]);
+      TEST_UNSIGNED(freqs[i], htAdd(ref, refStr));
+      if (freqs[i] > 1)
+      {
+         free(data[i]);
+         free(refStr);
+      }
+   }
+   TEST_UNSIGNED(htCapacity(ht), htCapacity(ref));
+   TEST_UNSIGNED(htUniqueEntries(ht), 60);
+   TEST_UNSIGNED(htTotalEntries(ht), 100);
+
+   for (i = 0; i < 100; i++)
+   {
+      keys[i] = malloc(8);
+      sprintf(keys[i], "k%d", i);
+   }
+   htLookUpBatch(ht, keys, 100, entries);
+   for (i = 0; i < 100; i++)
+   {
+      TEST_UNSIGNED(entries[i].frequency, i < 40 ? 2 : i < 60 ? 1 : 0);
+      TEST_BOOLEAN(entries[i].data == htLookUp(ht, keys[i]).data, 1);
+      free(keys[i]);
+   }
+
+   htDestroy(ht);
+   htDestroy(ref);
+}
+
+static void feat25()
+{
+   batchEngine(HT_ENGINE_CHAIN);
+   batchEngine(HT_ENGINE_ROBIN_HOOD);
+   batchEngine(HT_ENGINE_SWISS);
+   batchEngine(HT_ENGINE_CONCURRENT);
+}
+
+#define CONCURRENT_THREADS 4
+#define CONCURRENT_KEYS 2000
+
+typedef struct
+{
+   void *ht;
+   int first;
+   unsigned misses;
+} AddWorker;
+
+/* Every worker adds its own copy of every key, starting at a different key,
+ * and looks each one up straight after adding it.
+ */
+static void* concurrentWorker(void *arg)
+{
+   AddWorker *worker = arg;
+   int i, k;
+   char *str;
+
+   for (i = 0; i < CONCURRENT_KEYS; i++)
+   {
+      k = (worker->first + i) % CONCURRENT_KEYS;
+      str = malloc(8);
+      sprintf(str, "c%d", k);
+      if (htAdd(worker->ht, str) > 1)
+         free(str);
+      str = malloc(8);
+      sprintf(str, "c%d", k);
+      if (htLookUp(worker->ht, str).frequency == 0)
+         worker->misses++;
+      free(str);
+   }
+   return NULL;
+}
+
+static void feat26()
+{
+   int i;
+   unsigned size, total = 0;
+   unsigned sizes[] = {7, 31, 131, 521, 2053};
+   HTFunctions funcs = {hashString, compareString, NULL};
+   HTOptions options;
+   AddWorker workers[CONCURRENT_THREADS];
+   pthread_t threads[CONCURRENT_THREADS];
+   HTEntry *entries, entry;
+   void *ht;
+   char key[8];
+
+   htDefaultOptions(&options);
+   options.engine = HT_ENGINE_CONCURRENT;
+   ht = htCreateEx(&funcs, sizes, 5, 0.73, &options);
+
+   for (i = 0; i < CONCURRENT_THREADS; i++)
+   {
+      workers[i].ht = ht;
+      workers[i].first = i * CONCURRENT_KEYS / CONCURRENT_THREADS;
+      workers[i].misses = 0;
+      TEST_BOOLEAN(pthread_create(&threads[i], NULL, concurrentWorker,
+         &workers[i]) == 0, 1);
+   }
+   for (i = 0; i < CONCURRENT_THREADS; i++)
+   {
+      pthread_join(threads[i], NULL);
+      TEST_UNSIGNED(workers[i].misses, 0);
+   }
+
+   TEST_UNSIGNED(htUniqueEntries(ht), CONCURRENT_KEYS);
+   TEST_UNSIGNED(htTotalEntries(ht), CONCURRENT_THREADS * CONCURRENT_KEYS);
+   TEST_UNSIGNED(htCapacity(ht), 2053);
+
+   for (i = 0; i < CONCURRENT_KEYS; i++)
+   {
+      sprintf(key, "c%d", i);
+      entry = htLookUp(ht, key);
+      TEST_UNSIGNED(entry.frequency, CONCURRENT_THREADS);
+   }
+
+   entries = htToArray(ht, &size);
+   TEST_UNSIGNED(size, CONCURRENT_KEYS);
+   for (i = 0; i < size; i++)
+      total += entries[i].frequency;
+   TEST_UNSIGNED(total, CONCURRENT_THREADS * CONCURRENT_KEYS);
+   free(entries);
+
+   htDestroy(ht);
+}
+
+static unsigned destroyCalls;
+
+static void destroyCounted(const void *data)
+{
+   destroyCalls++;
+}
+
+static char* keyString(int i)
+{
+   char *str = malloc(8);
+
+   sprintf(str, "k%d", i);
+   return str;
+}
+
+static void feat27()
+{
+   int i;
+   unsigned sizes[] = {7, 31, 131, 521};
+   HTFunctions funcs = {hashString, compareString, destroyCounted};
+   void *dst = htCreate(&funcs, sizes, 4, 0.73);
+   void *src = htCreate(&funcs, sizes, 4, 0.73);
+   char key[8], *str;
+   HTEntry entry;
+
+   /* dst holds k0 .. k59 once, src holds k30 .. k89 twice */
+   for (i = 0; i < 60; i++)
+      htAdd(dst, keyString(i));
+   for (i = 30; i < 90; i++)
+   {
+      htAdd(src, keyString(i));
+      str = keyString(i);
+      TEST_UNSIGNED(htAdd(src, str), 2);
+      free(str);
+   }
+
+   destroyCalls = 0;
+   htMerge(dst, src);
+
+   /* src's second copies were never stored, its 30 duplicates are freed */
+   TEST_UNSIGNED(destroyCalls, 30);
+   TEST_UNSIGNED(htUniqueEntries(dst), 90);
+   TEST_UNSIGNED(htTotalEntries(dst), 180);
+   TEST_UNSIGNED(htCapacity(dst), 131);
+
+   for (i = 0; i < 90; i++)
+   {
+      sprintf(key, "k%d", i);
+      entry = htLookUp(dst, key);
+      TEST_UNSIGNED(entry.frequency, i < 30 ? 1 : i < 60 ? 3 : 2);
+   }
+   htDestroy(dst);
+   TEST_UNSIGNED(destroyCalls, 120);
+}
+
+#define MERGE_SHARDS 5
+
+static void feat28()
+{
+   int i;
+   unsigned j, size = 0, freq;
+   unsigned sizes[] = {31, 131, 521, 2053, 8209};
+   HTFunctions funcs = {hashString, compareString, NULL};
+   void *shards[MERGE_SHARDS];
+   void *ref = htCreate(&funcs, sizes, 5, 0.73);
+   HTEntry *entries;
+   char *str, *refStr;
+
+   for (i = 0; i < MERGE_SHARDS; i++)
+      shards[i] = htCreate(&funcs, sizes, 5, 0.73);
+
+   /* Shards of different sizes with random, partly overlapping strings */
+   for (i = 0; i < 6000; i++)
+   {
+      str = randomString();
+      refStr = malloc(strlen(str) + 1);
+      strcpy(refStr, str);
+      freq = htAdd(shards[i % 7 % MERGE_SHARDS], str);
+      if (htAdd(ref, refStr) > 1)
+         free(refStr);
+      if (freq > 1)
+         free(str);
+   }
+
+   htMergeAll(shards, MERGE_SHARDS, 3);
+   TEST_UNSIGNED(htUniqueEntries(shards[0]), htUniqueEntries(ref));
+   TEST_UNSIGNED(htTotalEntries(shards[0]), htTotalEntries(ref));
+   TEST_UNSIGNED(htCapacity(shards[0]), htCapacity(ref));
+
+   entries = htToArray(ref, &size);
+   for (j = 0; j < size; j++)
+      TEST_UNSIGNED(htLookUp(shards[0], entries[j].data).frequency,
+         entries[j].frequency);
+   free(entries);
+
+   htDestroy(shards[0]);
+   htDestroy(ref);
+}
+
+/* k0 .. k199 with k0 .. k49 added twice, then removed down to nothing with
+ * the table shrinking back through the sizes on the way.
+ */
+static void removeWith(HTOptions *options)
+{
+   int i;
+   unsigned sizes[] = {7, 31, 131, 521};
+   HTFunctions funcs = {hashString, compareString, destroyCounted};
+   void *ht;
+   char key[12], *str;
+
+   options->shrinkLoadFactor = 0.2;
+   ht = htCreateEx(&funcs, sizes, 4, 0.73, options);
+   for (i = 0; i < 250; i++)
+   {
+      str = keyString(i % 200);
+      if (htAdd(ht, str) > 1)
+         free(str);
+   }
+   TEST_UNSIGNED(htCapacity(ht), 521);
+
+   destroyCalls = 0;
+   TEST_UNSIGNED(htDecrement(ht, "k0"), 1);
+   TEST_UNSIGNED(htTotalEntries(ht), 249);
+   TEST_UNSIGNED(htDecrement(ht, "k0"), 0);
+   TEST_UNSIGNED(destroyCalls, 1);
+   TEST_UNSIGNED(htLookUp(ht, "k0").frequency, 0);
+   TEST_UNSIGNED(htUniqueEntries(ht), 199);
+
+   str = htRemove(ht, "k1");
+   TEST_STRING(str, "k1");
+   free(str);
+   TEST_UNSIGNED(htTotalEntries(ht), 246);
+   TEST_UNSIGNED(htUniqueEntries(ht), 198);
+
+   TEST_BOOLEAN(htRemove(ht, "k999") == NULL, 1);
+   TEST_UNSIGNED(htDecrement(ht, "k999"), 0);
+   TEST_UNSIGNED(htTotalEntries(ht), 246);
+   TEST_UNSIGNED(destroyCalls, 1);
+
+   /* Every entry left must still be found after each removal */
+   for (i = 199; i >= 2; i--)
+   {
+      sprintf(key, "k%d", i);
+      free(htRemove(ht, key));
+      if (i == 105)
+         TEST_UNSIGNED(htCapacity(ht), 521);
+      if (i == 97)
+      {
+         TEST_UNSIGNED(htCapacity(ht), 131);
+         for (i--; i >= 2; i--)
+         {
+            sprintf(key, "k%d", i);
+            TEST_UNSIGNED(htLookUp(ht, key).frequency, i < 50 ? 2 : 1);
+         }
+         i = 97;
+      }
+   }
+   TEST_UNSIGNED(htUniqueEntries(ht), 0);
+   TEST_UNSIGNED(htTotalEntries(ht), 0);
+   TEST_UNSIGNED(htCapacity(ht), 7);
+   TEST_UNSIGNED(destroyCalls, 1);
+
+   /* Slots and nodes freed by the removals are reused */
+   for (i = 0; i < 100; i++)
+      htAdd(ht, keyString(i + 1000));
+   for (i = 0; i < 100; i++)
+   {
+      sprintf(key, "k%d", i + 1000);
+      TEST_UNSIGNED(htLookUp(ht, key).frequency, 1);
+   }
+   TEST_UNSIGNED(htCapacity(ht), 521);
+   htDestroy(ht);
+   TEST_UNSIGNED(destroyCalls, 101);
+}
+
+static void feat29()
+{
+   HTOptions options;
+
+   htDefaultOptions(&options);
+   removeWith(&options);
+   options.chainOrder = HT_CHAIN_BY_FREQUENCY;
+   removeWith(&options);
+   htDefaultOptions(&options);
+   options.incrementalRehash = 2;
+   removeWith(&options);
+   options.engine = HT_ENGINE_ROBIN_HOOD;
+   removeWith(&options);
+   options.engine = HT_ENGINE_SWISS;
+   removeWith(&options);
+}
+
+static int countVisit(HTEntry *entry, void *context)
+{
+   unsigned *visits = context;
+
+   return ++visits[0] == visits[1];
+}
+
+/* The cursor must produce htToArray's entries in htToArray's order, also
+ * when restarted at the bucket after the one it stopped in.
+ */
+static void iterEngine(HTEngineType engine)
+{
+   int i;
+   unsigned j = 0, size = 0, bucket, visits[2] = {0, 0};
+   unsigned sizes[] = {7, 31, 131, 521};
+   HTFunctions funcs = {hashString, compareString, NULL};
+   HTOptions options;
+   HTEntry *entries, *entry;
+   HTIter iter;
+   void *ht;
+
+   htDefaultOptions(&options);
+   options.engine = engine;
+   ht = htCreateEx(&funcs, sizes, 4, 0.73, &options);
+
+   htIterBegin(ht, &iter, 0);
+   TEST_BOOLEAN(htIterNext(&iter) == NULL, 1);
+   TEST_UNSIGNED(htForEach(ht, countVisit, visits), 0);
+
+   for (i = 0; i < 300; i++)
+      htAdd(ht, keyString(i));
+   entries = htToArray(ht, &size);
+
+   /* Stop in the middle, finish the bucket, then resume after it */
+   htIterBegin(ht, &iter, 0);
+   while (j < size / 2)
+   {
+      entry = htIterNext(&iter);
+      TEST_BOOLEAN(entry->data == entries[j].data, 1);
+      TEST_UNSIGNED(entry->frequency, entries[j++].frequency);
+   }
+   bucket = iter.bucket;
+   while ((entry = htIterNext(&iter)) != NULL && iter.bucket == bucket)
+      TEST_BOOLEAN(entry->data == entries[j++].data, 1);
+   htIterBegin(ht, &iter, bucket + 1);
+   while ((entry = htIterNext(&iter)) != NULL)
+      TEST_BOOLEAN(entry->data == entries[j++].data, 1);
+   TEST_UNSIGNED(j, size);
+   TEST_BOOLEAN(htIterNext(&iter) == NULL, 1);
+
+   /* In place: the cursor hands out the stored entries */
+   htIterBegin(ht, &iter, 0);
+   entry = htIterNext(&iter);
+   TEST_BOOLEAN(entry->data == htLookUp(ht, entry->data).data, 1);
+
+   visits[1] = 0;
+   TEST_UNSIGNED(htForEach(ht, countVisit, visits), size);
+   visits[0] = 0;
+   visits[1] = 10;
+   TEST_UNSIGNED(htForEach(ht, countVisit, visits), 10);
+
+   free(entries);
+   htDestroy(ht);
+}
+
+static void feat30()
+{
+   iterEngine(HT_ENGINE_CHAIN);
+   iterEngine(HT_ENGINE_ROBIN_HOOD);
+   iterEngine(HT_ENGINE_SWISS);
+   iterEngine(HT_ENGINE_CONCURRENT);
+}
+
+static int compareRank(const void *a, const void *b)
+{
+   const HTEntry *e1 = a, *e2 = b;
+
+   if (e1->frequency != e2->frequency)
+      return e1->frequency < e2->frequency ? 1 : -1;
+   return strcmp(e1->data, e2->data);
+}
+
+/* htTopK and htTopKParallel must agree with sorting all of htToArray */
+static void topKEngine(HTEngineType engine)
+{
+   int i;
+   unsigned j, size = 0, count;
+   unsigned sizes[] = {31, 131, 521, 2053};
+   HTFunctions funcs = {hashString, compareString, NULL};
+   HTOptions options;
+   HTEntry *entries, top[120], topPar[120];
+   void *ht;
+   char *str;
+
+   htDefaultOptions(&options);
+   options.engine = engine;
+   ht = htCreateEx(&funcs, sizes, 4, 0.73, &options);
+
+   TEST_UNSIGNED(htTopK(ht, 10, top), 0);
+
+   /* 100 keys with frequencies of 20, 40 or 60, so ties decide the cut */
+   for (i = 0; i < 3000; i++)
+   {
+      str = keyString(i * 7 % 50 * (i % 3 + 1));
+      if (htAdd(ht, str) > 1)
+         free(str);
+   }
+   entries = htToArray(ht, &size);
+   qsort(entries, size, sizeof(HTEntry), compareRank);
+
+   count = htTopK(ht, 60, top);
+   TEST_UNSIGNED(count, 60);
+   for (j = 0; j < count; j++)
+   {
+      TEST_STRING(top[j].data, entries[j].data);
+      TEST_UNSIGNED(top[j].frequency, entries[j].frequency);
+   }
+
+   count = htTopKParallel(ht, 60, topPar, 3);
+   TEST_UNSIGNED(count, 60);
+   for (j = 0; j < count; j++)
+      TEST_BOOLEAN(topPar[j].data == top[j].data, 1);
+
+   TEST_UNSIGNED(htTopK(ht, 120, top), size);
+   TEST_UNSIGNED(htTopKParallel(ht, 120, topPar, 4), size);
+   TEST_STRING(topPar[size - 1].data, entries[size - 1].data);
+   TEST_UNSIGNED(htTopK(ht, 0, NULL), 0);
+   TEST_UNSIGNED(htTopKParallel(ht, 0, NULL, 2), 0);
+
+   free(entries);
+   htDestroy(ht);
+}
+
+static void feat31()
+{
+   topKEngine(HT_ENGINE_CHAIN);
+   topKEngine(HT_ENGINE_SWISS);
+}
+
+/* With a Bloom filter in front no present key may ever be missed, across
+ * growth, removals and a merge, and misses must still miss.
+ */
+static void bloomWith(HTOptions *options)
+{
+   int i;
+   unsigned sizes[] = {7, 31, 131, 521, 2053};
+   HTFunctions funcs = {hashString, compareString, NULL};
+   HTMetricsEx metrics;
+   void *ht, *src;
+   void *keys[3];
+   HTEntry found[3];
+   size_t bytes;
+   char key[12];
+
+   options->bloomFalsePositiveRate = 0.01;
+   options->shrinkLoadFactor = 0.2;
+   ht = htCreateEx(&funcs, sizes, 5, 0.73, options);
+   htMetricsEx(ht, &metrics);
+   free(metrics.histogram);
+   TEST_BOOLEAN(metrics.filterBytes > 0, 1);
+   bytes = metrics.filterBytes;
+
+   for (i = 0; i < 1000; i++)
+      htAdd(ht, keyString(i));
+   htMetricsEx(ht, &metrics);
+   free(metrics.histogram);
+   TEST_BOOLEAN(metrics.filterBytes > bytes, 1);
+   for (i = 0; i < 1000; i++)
+   {
+      sprintf(key, "k%d", i);
+      TEST_UNSIGNED(htLookUp(ht, key).frequency, 1);
+      sprintf(key, "m%d", i);
+      TEST_UNSIGNED(htLookUp(ht, key).frequency, 0);
+   }
+
+   /* Removing most keys rebuilds the filter smaller */
+   bytes = metrics.filterBytes;
+   for (i = 0; i < 900; i++)
+   {
+      sprintf(key, "k%d", i);
+      free(htRemove(ht, key));
+   }
+   htMetricsEx(ht, &metrics);
+   free(metrics.histogram);
+   TEST_BOOLEAN(metrics.filterBytes < bytes, 1);
+   for (i = 0; i < 1000; i++)
+   {
+      sprintf(key, "k%d", i);
+      TEST_UNSIGNED(htLookUp(ht, key).frequency, i < 900 ? 0 : 1);
+   }
+
+   /* Merged in entries are covered too */
+   if (options->engine == HT_ENGINE_CHAIN)
+   {
+      src = htCreate(&funcs, sizes, 5, 0.73);
+      for (i = 0; i < 500; i++)
+         htAdd(src, keyString(i + 5000));
+      htMerge(ht, src);
+      for (i = 0; i < 500; i++)
+      {
+         sprintf(key, "k%d", i + 5000);
+         TEST_UNSIGNED(htLookUp(ht, key).frequency, 1);
+      }
+   }
+
+   keys[0] = "k999";
+   keys[1] = "m999";
+   keys[2] = "k950";
+   htLookUpBatch(ht, keys, 3, found);
+   TEST_UNSIGNED(found[0].frequency, 1);
+   TEST_UNSIGNED(found[1].frequency, 0);
+   TEST_UNSIGNED(found[2].frequency, 1);
+   htDestroy(ht);
+}
+
+/* Filter rebuilds, on growth and after removals, leave an incremental
+ * rehash running: both bucket arrays are still allocated afterwards.
+ */
+static void bloomMigrating()
+{
+   int i;
+   unsigned sizes[] = {521, 2053};
+   HTFunctions funcs = {hashString, compareString, NULL};
+   HTOptions options;
+   void *ht;
+   char key[12];
+
+   htDefaultOptions(&options);
+   options.incrementalRehash = 1;
+   options.bloomFalsePositiveRate = 0.01;
+   ht = htCreateEx(&funcs, sizes, 2, 0.73, &options);
+   for (i = 0; i < 382; i++)
+      htAdd(ht, keyString(i));
+   TEST_UNSIGNED(htMemoryUsage(ht).bucketBytes, (2053 + 521) * sizeof(void*));
+   for (i = 0; i < 200; i++)
+   {
+      sprintf(key, "k%d", i);
+      free(htRemove(ht, key));
+   }
+   TEST_UNSIGNED(htMemoryUsage(ht).bucketBytes, (2053 + 521) * sizeof(void*));
+   for (i = 0; i < 382; i++)
+   {
+      sprintf(key, "k%d", i);
+      TEST_UNSIGNED(htLookUp(ht, key).frequency, i < 200 ? 0 : 1);
+   }
+   htDestroy(ht);
+}
+
+static void feat32()
+{
+   HTOptions options;
+   HTMetricsEx metrics;
+   unsigned sizes[] = {7, 31};
+   HTFunctions funcs = {hashString, compareString, NULL};
+   void *ht = htCreate(&funcs, sizes, 2, 0.73);
+
+   htMetricsEx(ht, &metrics);
+   free(metrics.histogram);
+   TEST_UNSIGNED(metrics.filterBytes, 0);
+   htDestroy(ht);
+
+   htDefaultOptions(&options);
+   bloomWith(&options);
+   options.incrementalRehash = 2;
+   bloomWith(&options);
+   htDefaultOptions(&options);
+   options.engine = HT_ENGINE_ROBIN_HOOD;
+   bloomWith(&options);
+   options.engine = HT_ENGINE_SWISS;
+   bloomWith(&options);
+   bloomMigrating();
+}
+
+/* The largest bucket when the hashes are reduced to 1024 buckets. */
+static unsigned maxBucket(unsigned hashes[], unsigned count)
+{
+   unsigned i, buckets[1024] = {0}, max = 0;
+
+   for (i = 0; i < count; i++)
+      if (++buckets[hashes[i] & 1023] > max)
+         max = buckets[hashes[i] & 1023];
+   return max;
+}
+
+static HTBytes* newBytes(const char *bytes, size_t len)
+{
+   HTBytes *key = malloc(sizeof(HTBytes) + len);
+
+   memcpy(key + 1, bytes, len);
+   key->ptr = key + 1;
+   key->len = len;
+   return key;
+}
+
+static void feat33()
+{
+   unsigned i, j, hash, hashes[10000];
+   unsigned sizes[] = {7, 31, 131};
+   HTFunctions funcs = {htHashBytes, htCompareBytes, NULL};
+   char buf[130], key[12];
+   HTBytes a, b, *stored;
+   uint64_t wide;
+   void *ht;
+
+   a.ptr = "abc";
+   a.len = 3;
+   TEST_UNSIGNED(htHashBytes(&a), htHashString("abc"));
+   TEST_UNSIGNED(htHashMemory("abc", 3, 0), htHashString("abc"));
+   TEST_BOOLEAN(htHashMemory("abc", 3, 1) != htHashString("abc"), 1);
+
+   /* Every byte of every length counts, wherever the key starts */
+   for (i = 0; i < 128; i++)
+      buf[i] = (char)(i * 37);
+   for (i = 0; i <= 100; i++)
+   {
+      hash = htHashMemory(buf + 1, i, 0);
+      memmove(buf, buf + 1, i);
+      TEST_UNSIGNED(htHashMemory(buf, i, 0), hash);
+      memmove(buf + 1, buf, i);
+      TEST_BOOLEAN(htHashMemory(buf + 1, i + 1, 0) != hash, 1);
+      for (j = 0; j < i; j++)
+      {
+         buf[j + 1] ^= 1;
+         TEST_BOOLEAN(htHashMemory(buf + 1, i, 0) != hash, 1);
+         buf[j + 1] ^= 1;
+      }
+   }
+
+   /* Sequences spread evenly, about 10 per bucket */
+   for (i = 0; i < 10000; i++)
+   {
+      sprintf(key, "k%u", i);
+      hashes[i] = htHashString(key);
+   }
+   TEST_BOOLEAN(maxBucket(hashes, 10000) < 30, 1);
+   for (i = 0; i < 10000; i++)
+      hashes[i] = htHashUnsigned(&i);
+   TEST_BOOLEAN(maxBucket(hashes, 10000) < 30, 1);
+   for (i = 0; i < 10000; i++)
+   {
+      wide = (uint64_t)i << 40;
+      hashes[i] = htHashUint64(&wide);
+   }
+   TEST_BOOLEAN(maxBucket(hashes, 10000) < 30, 1);
+   TEST_BOOLEAN(htMix32(1) != htMix32(2), 1);
+   TEST_BOOLEAN(htMix64(1) != htMix64((uint64_t)1 << 32), 1);
+
+   /* Keys with NUL bytes, and prefixes ordered first */
+   a.ptr = "a\0b";
+   b.ptr = "a\0c";
+   b.len = 3;
+   TEST_BOOLEAN(htHashBytes(&a) != htHashBytes(&b), 1);
+   TEST_BOOLEAN(htCompareBytes(&a, &b) < 0, 1);
+   b.len = 2;
+   TEST_BOOLEAN(htCompareBytes(&a, &b) > 0, 1);
+   TEST_BOOLEAN(htCompareBytes(&b, &a) < 0, 1);
+   b.len = 0;
+   a.len = 0;
+   TEST_SIGNED(htCompareBytes(&a, &b), 0);
+
+   ht = htCreate(&funcs, sizes, 3, 0.73);
+   for (i = 0; i < 200; i++)
+   {
+      memcpy(buf, &i, sizeof(i));
+      stored = newBytes(buf, i % 5 + 1);
+      if (htAdd(ht, stored) > 1)
+         free(stored);
+   }
+   TEST_UNSIGNED(htUniqueEntries(ht), 200);
+   a.ptr = "\0\0\0";
+   a.len = 3;
+   TEST_UNSIGNED(htLookUp(ht, &a).frequency, 0);
+   a.len = 1;
+   TEST_UNSIGNED(htLookUp(ht, &a).frequency, 1);
+   htDestroy(ht);
+}
+
+/* 10000 keys in 16381 buckets, a mean load of 0.61 */
+static void metricsWith(HTEngineType engine, FNHash hash, HTMetricsEx *metrics)
+{
+   int i;
+   unsigned j, entries = 0, buckets = 0;
+   unsigned sizes[] = {16381, 32771};
+   HTFunctions funcs = {NULL, compareString, NULL};
+   HTOptions options;
+   void *ht;
+
+   funcs.hash = hash;
+   htDefaultOptions(&options);
+   options.engine = engine;
+   ht = htCreateEx(&funcs, sizes, 2, 0.73, &options);
+
+   htMetricsEx(ht, metrics);
+   TEST_UNSIGNED(metrics->histogramLength, 1);
+   TEST_UNSIGNED(metrics->histogram[0], 16381);
+   TEST_UNSIGNED(metrics->degreesOfFreedom, 0);
+   TEST_REAL(metrics->hitProbes, 0, DBL_EPSILON);
+   free(metrics->histogram);
+
+   for (i = 0; i < 10000; i++)
+      htAdd(ht, keyString(i));
+   htMetricsEx(ht, metrics);
+   for (j = 0; j < metrics->histogramLength; j++)
+   {
+      buckets += metrics->histogram[j];
+      entries += j * metrics->histogram[j];
+   }
+   TEST_UNSIGNED(buckets, 16381);
+   TEST_UNSIGNED(entries, 10000);
+   TEST_BOOLEAN(metrics->hitProbes >= 1, 1);
+   htDestroy(ht);
+}
+
+static void feat34()
+{
+   HTMetricsEx chain, other;
+   double mean = 10000 / 16381.0;
+   unsigned i;
+
+   /* A good hash is close to Poisson */
+   metricsWith(HT_ENGINE_CHAIN, htHashString, &chain);
+   TEST_BOOLEAN(chain.degreesOfFreedom >= 2, 1);
+   TEST_BOOLEAN(chain.chiSquare / chain.degreesOfFreedom < 4, 1);
+   TEST_REAL(chain.emptyBucketRatio, exp(-mean), 0.02);
+   TEST_REAL(chain.loadVariance, mean, 0.1);
+   TEST_REAL(chain.hitProbes, 1 + mean / 2, 0.1);
+   TEST_REAL(chain.missProbes, mean, 1e-9);
+
+   /* Home buckets do not depend on the engine, probing does */
+   metricsWith(HT_ENGINE_SWISS, htHashString, &other);
+   TEST_UNSIGNED(other.histogramLength, chain.histogramLength);
+   for (i = 0; i < chain.histogramLength; i++)
+      TEST_UNSIGNED(other.histogram[i], chain.histogram[i]);
+   TEST_REAL(other.chiSquare, chain.chiSquare, 1e-9);
+   TEST_BOOLEAN(other.missProbes >= 1, 1);
+   free(other.histogram);
+   metricsWith(HT_ENGINE_ROBIN_HOOD, htHashString, &other);
+   TEST_REAL(other.loadVariance, chain.loadVariance, 1e-9);
+   TEST_BOOLEAN(other.missProbes >= 1, 1);
+   free(other.histogram);
+   metricsWith(HT_ENGINE_CONCURRENT, htHashString, &other);
+   TEST_REAL(other.missProbes, mean, 1e-9);
+   free(other.histogram);
+   free(chain.histogram);
+
+   /* A constant hash puts everything in one bucket */
+   metricsWith(HT_ENGINE_CHAIN, hashBad, &chain);
+   TEST_UNSIGNED(chain.histogramLength, 10001);
+   TEST_UNSIGNED(chain.histogram[10000], 1);
+   TEST_REAL(chain.emptyBucketRatio, 16380 / 16381.0, 1e-9);
+   TEST_REAL(chain.hitProbes, 5000.5, 1e-9);
+   TEST_BOOLEAN(chain.chiSquare / chain.degreesOfFreedom > 1000, 1);
+   free(chain.histogram);
+}
+
+/* Keys of 3 to 25 bytes, so some fit in 16 bytes and some spill. */
+static void keyName(char *buf, unsigned i)
+{
+   sprintf(buf, "%.*s%u", (int)(i % 5) * 4, "spill-spill-spill-", i % 701);
+}
+
+static void *inlineTable(unsigned inlineKeyBytes, unsigned incremental)
+{
+   unsigned sizes[] = {7, 31, 131, 521, 2053};
+   HTFunctions funcs = {hashString, compareString, NULL};
+   HTOptions options;
+
+   htDefaultOptions(&options);
+   options.inlineKeyBytes = inlineKeyBytes;
+   options.incrementalRehash = incremental;
+   return htCreateEx(&funcs, sizes, 5, 0.73f, &options);
+}
+
+static void feat35()
+{
+   void *ht = inlineTable(13, 0), *ref = inlineTable(0, 0);
+   void *other = inlineTable(13, 2);
+   HTEntry *entries, *refEntries, entry;
+   unsigned i, size, refSize;
+   char buf[32], *copy;
+
+   for (i = 0; i < 3000; i++)
+   {
+      keyName(buf, i);
+      TEST_UNSIGNED(htAdd(ht, buf), htLookUp(ref, buf).frequency + 1);
+      copy = malloc(strlen(buf) + 1);
+      strcpy(copy, buf);
+      if (htAdd(ref, copy) > 1)
+         free(copy);
+      keyName(buf, i * 3);
+      htAdd(other, buf);
+   }
+   TEST_UNSIGNED(htCapacity(ht), htCapacity(ref));
+
+   /* Same entries in the same order, but the keys belong to the table */
+   entries = htToArray(ht, &size);
+   refEntries = htToArray(ref, &refSize);
+   TEST_UNSIGNED(size, refSize);
+   for (i = 0; i < size; i++)
+   {
+      TEST_STRING(entries[i].data, refEntries[i].data);
+      TEST_UNSIGNED(entries[i].frequency, refEntries[i].frequency);
+   }
+   free(entries);
+   free(refEntries);
+   keyName(buf, 704);
+   entry = htLookUp(ht, buf);
+   TEST_UNSIGNED(strlen(buf), 17);
+   TEST_STRING(entry.data, buf);
+   TEST_BOOLEAN(entry.data != buf, 1);
+
+   /* htRemove hands back the argument and frees the table's copy */
+   TEST_BOOLEAN(htRemove(ht, buf) == buf, 1);
+   TEST_BOOLEAN(htRemove(ht, buf) == NULL, 1);
+   strcpy(buf, "7");
+   TEST_UNSIGNED(htDecrement(ht, buf), htLookUp(ref, buf).frequency - 1);
+   while (htDecrement(ht, buf) > 0)
+      ;
+   TEST_UNSIGNED(htLookUp(ht, buf).frequency, 0);
+   TEST_UNSIGNED(htUniqueEntries(ht), htUniqueEntries(ref) - 2);
+   TEST_UNSIGNED(htAdd(ht, buf), 1);
+
+   /* Merged nodes keep their keys, folded ones release them */
+   entries = htToArray(other, &refSize);
+   for (size = htUniqueEntries(ht), i = 0; i < refSize; i++)
+      size += htLookUp(ht, entries[i].data).frequency == 0;
+   free(entries);
+   keyName(buf, 704);
+   refSize = htLookUp(other, buf).frequency;
+   htMerge(ht, other);
+   TEST_UNSIGNED(htUniqueEntries(ht), size);
+   TEST_UNSIGNED(htLookUp(ht, buf).frequency, refSize);
+   TEST_BOOLEAN(refSize > 0, 1);
+
+   htDestroy(ht);
+   htDestroy(ref);
+}
+
+/* Adds every word of a text without NUL terminating any of them. */
+static void addWords(void *ht, const char *text)
+{
+   size_t len;
+
+   while (*text)
+   {
+      len = strcspn(text, " ");
+      htAddString(ht, text, len);
+      text += len + strspn(text + len, " ");
+   }
+}
+
+static void *arenaTable(HTEngineType engine, unsigned inlineKeyBytes)
+{
+   unsigned sizes[] = {5, 23, 101, 1009};
+   HTFunctions funcs = {hashString, compareString, NULL};
+   HTOptions options;
+
+   htDefaultOptions(&options);
+   options.engine = engine;
+   options.inlineKeyBytes = inlineKeyBytes;
+   return htCreateEx(&funcs, sizes, 4, 0.73f, &options);
+}
+
+static void feat36()
+{
+   const char *text = "the cat saw the dog and the dog saw a cat";
+   HTEngineType engines[] = {HT_ENGINE_CHAIN, HT_ENGINE_ROBIN_HOOD,
+      HT_ENGINE_SWISS};
+   void *ht, *other;
+   char buf[16], *big;
+   unsigned e, i;
+
+   for (e = 0; e < 3; e++)
+   {
+      ht = arenaTable(engines[e], 0);
+      addWords(ht, text);
+      TEST_UNSIGNED(htTotalEntries(ht), 11);
+      TEST_UNSIGNED(htUniqueEntries(ht), 6);
+      TEST_UNSIGNED(htLookUp(ht, "the").frequency, 3);
+      TEST_UNSIGNED(htLookUp(ht, "dog").frequency, 2);
+      TEST_UNSIGNED(htLookUp(ht, "a").frequency, 1);
+      TEST_UNSIGNED(htAddString(ht, "cats", 3), 3);
+      TEST_UNSIGNED(htAddString(ht, "", 0), 1);
+      TEST_STRING(htRemove(ht, "saw"), "saw");
+
+      /* Growth through every size and keys larger than a chunk */
+      for (i = 0; i < 1500; i++)
+      {
+         sprintf(buf, "w%u", i % 700);
+         htAddString(ht, buf, strlen(buf));
+      }
+      TEST_UNSIGNED(htLookUp(ht, "w699").frequency, 2);
+      TEST_UNSIGNED(htLookUp(ht, "w0").frequency, 3);
+      big = malloc(10001);
+      memset(big, 'x', 10000);
+      big[10000] = '\0';
+      TEST_UNSIGNED(htAddString(ht, big, 10000), 1);
+      TEST_UNSIGNED(htAddString(ht, big, 10000), 2);
+      TEST_STRING(htLookUp(ht, big).data, big);
+      free(big);
+      TEST_STRING(htLookUp(ht, "the").data, "the");
+      htDestroy(ht);
+   }
+
+   /* The merged table takes over the arena of the other */
+   ht = arenaTable(HT_ENGINE_CHAIN, 0);
+   other = arenaTable(HT_ENGINE_CHAIN, 0);
+   addWords(ht, text);
+   addWords(other, "a bird saw the cat");
+   htMerge(ht, other);
+   TEST_UNSIGNED(htUniqueEntries(ht), 7);
+   TEST_UNSIGNED(htLookUp(ht, "cat").frequency, 3);
+   TEST_STRING(htLookUp(ht, "bird").data, "bird");
+   htDestroy(ht);
+
+   /* With inline keys the arena is scratch and htAdd may be mixed in */
+   ht = arenaTable(HT_ENGINE_CHAIN, 8);
+   addWords(ht, text);
+   strcpy(buf, "the");
+   TEST_UNSIGNED(htAdd(ht, buf), 4);
+   TEST_BOOLEAN(htRemove(ht, "dog") != NULL, 1);
+   TEST_UNSIGNED(htUniqueEntries(ht), 5);
+   htDestroy(ht);
+
+   /* In either order */
+   ht = arenaTable(HT_ENGINE_CHAIN, 8);
+   strcpy(buf, "cat");
+   TEST_UNSIGNED(htAdd(ht, buf), 1);
+   addWords(ht, text);
+   TEST_UNSIGNED(htLookUp(ht, "cat").frequency, 3);
+   TEST_UNSIGNED(htUniqueEntries(ht), 6);
+   htDestroy(ht);
+}
+
+typedef struct
+{
+   int x, y;
+} Point;
+
+static unsigned hashPoint(const void *data)
+{
+   const Point *p = data;
+
+   return htMix32((unsigned)p->x * 31u + (unsigned)p->y);
+}
+
+static int comparePoint(const void *a, const void *b)
+{
+   const Point *p = a, *q = b;
+
+   return p->x != q->x ? (p->x < q->x ? -1 : 1) :
+      p->y != q->y ? (p->y < q->y ? -1 : 1) : 0;
+}
+
+static void *makePoint(const void *probe, void *context)
+{
+   Point *p = malloc(sizeof(Point));
+
+   *p = *(const Point*)probe;
+   ++*(unsigned*)context;
+   return p;
+}
+
+static void feat37()
+{
+   unsigned sizes[] = {7, 61, 509};
+   HTFunctions funcs = {hashPoint, comparePoint, NULL};
+   HTEngineType engines[] = {HT_ENGINE_CHAIN, HT_ENGINE_ROBIN_HOOD,
+      HT_ENGINE_SWISS};
+   HTOptions options;
+   HTEntry entry;
+   Point probe, *copy;
+   void *ht, *ref;
+   unsigned e, i, made;
+
+   for (e = 0; e < 3; e++)
+   {
+      htDefaultOptions(&options);
+      options.engine = engines[e];
+      ht = htCreateEx(&funcs, sizes, 3, 0.73f, &options);
+      ref = htCreateEx(&funcs, sizes, 3, 0.73f, &options);
+      made = 0;
+      for (i = 0; i < 2000; i++)
+      {
+         probe.x = (int)(i * 7 % 17);
+         probe.y = -(int)(i % 13);
+         entry = htFindOrInsert(ht, &probe, makePoint, &made);
+         copy = malloc(sizeof(Point));
+         *copy = probe;
+         TEST_UNSIGNED(entry.frequency, htAdd(ref, copy));
+         if (entry.frequency > 1)
+            free(copy);
+
+         /* The stored data, never the probe */
+         TEST_BOOLEAN(entry.data == htLookUp(ht, &probe).data, 1);
+         TEST_SIGNED(comparePoint(entry.data, &probe), 0);
+      }
+      TEST_UNSIGNED(made, htUniqueEntries(ht));
+      TEST_UNSIGNED(htUniqueEntries(ht), 221);
+      TEST_UNSIGNED(htTotalEntries(ht), 2000);
+      TEST_UNSIGNED(htCapacity(ht), htCapacity(ref));
+      htDestroy(ht);
+      htDestroy(ref);
+   }
+}
+
+static size_t serializeString(const void *data, void *buffer, size_t size)
+{
+   size_t len = strlen(data) + 1;
+
+   if (len <= size)
+      memcpy(buffer, data, len);
+   return len;
+}
+
+static size_t serializePoint(const void *data, void *buffer, size_t size)
+{
+   if (sizeof(Point) <= size)
+      memcpy(buffer, data, sizeof(Point));
+   return sizeof(Point);
+}
+
+/* Saves and maps a table, then checks that it serves the same entries. */
+static void *saveAndMap(void *ht, HTFunctions *funcs, FNSerialize serialize)
+{
+   const char *path = "feature38.img";
+   HTEntry *entries;
+   void *mapped;
+   unsigned i, size;
+
+   TEST_SIGNED(htSave(ht, path, serialize), 0);
+   mapped = htLoadMapped(path, funcs);
+   remove(path);
+   TEST_BOOLEAN(mapped != NULL, 1);
+   TEST_UNSIGNED(htCapacity(mapped), htCapacity(ht));
+   TEST_UNSIGNED(htUniqueEntries(mapped), htUniqueEntries(ht));
+   TEST_UNSIGNED(htTotalEntries(mapped), htTotalEntries(ht));
+   entries = htToArray(ht, &size);
+   for (i = 0; i < size; i++)
+      TEST_UNSIGNED(htLookUp(mapped, entries[i].data).frequency,
+         entries[i].frequency);
+   free(entries);
+   return mapped;
+}
+
+/* Overwrites the 32 bit word at offset in a snapshot file. */
+static void patchImage(const char *path, long offset, unsigned value)
+{
+   FILE *file = fopen(path, "r+b");
+
+   fseek(file, offset, SEEK_SET);
+   fwrite(&value, sizeof(value), 1, file);
+   fclose(file);
+}
+
+/* A snapshot replaced while it is mapped, and damaged snapshots. The header
+ * is 56 bytes with the capacity at offset 16, then come the bucket starts.
+ */
+static void replaceAndDamage(void *ht, void *other, HTFunctions *funcs)
+{
+   const char *path = "feature38.img";
+   void *mapped, *remapped;
+
+   TEST_SIGNED(htSave(ht, path, serializeString), 0);
+   mapped = htLoadMapped(path, funcs);
+   TEST_SIGNED(htSave(other, path, serializeString), 0);
+   remapped = htLoadMapped(path, funcs);
+   TEST_UNSIGNED(htUniqueEntries(mapped), htUniqueEntries(ht));
+   TEST_UNSIGNED(htUniqueEntries(remapped), htUniqueEntries(other));
+   TEST_UNSIGNED(htLookUp(mapped, "key0").frequency,
+      htLookUp(ht, "key0").frequency);
+   htDestroy(remapped);
+   htDestroy(mapped);
+
+   patchImage(path, 56 + 4, 0xFFFFFFFFu);
+   TEST_BOOLEAN(htLoadMapped(path, funcs) == NULL, 1);
+   TEST_SIGNED(htSave(ht, path, serializeString), 0);
+   patchImage(path, 56 + 8, 0);
+   patchImage(path, 56 + 4, 1);
+   TEST_BOOLEAN(htLoadMapped(path, funcs) == NULL, 1);
+   TEST_SIGNED(htSave(ht, path, serializeString), 0);
+   patchImage(path, 16, 0xFFFFFFFFu);
+   TEST_BOOLEAN(htLoadMapped(path, funcs) == NULL, 1);
+   remove(path);
+}
+
+static void feat38()
+{
+   unsigned sizes[] = {13, 127, 1021}, i, size, mappedSize;
+   HTFunctions funcs = {hashString, compareString, NULL};
+   HTFunctions pointFuncs = {hashPoint, comparePoint, NULL};
+   HTEntry *entries, *mappedEntries, top[5], mappedTop[5], *entry;
+   HTMetrics metrics, mappedMetrics;
+   HTOptions options;
+   HTIter iter;
+   Point probe;
+   void *ht, *mapped, *other;
+   FILE *file;
+   char buf[32], *str;
+   unsigned made;
+
+   ht = htCreate(&funcs, sizes, 3, 0.73f);
+   for (i = 0; i < 2000; i++)
+   {
+      sprintf(buf, "key%u", i * i % 811);
+      str = malloc(strlen(buf) + 1);
+      strcpy(str, buf);
+      if (htAdd(ht, str) > 1)
+         free(str);
+   }
+   mapped = saveAndMap(ht, &funcs, serializeString);
+
+   /* Same buckets, so the same order and chain metrics as the chain */
+   entries = htToArray(ht, &size);
+   mappedEntries = htToArray(mapped, &mappedSize);
+   TEST_UNSIGNED(mappedSize, size);
+   for (i = 0; i < size; i++)
+   {
+      TEST_STRING(mappedEntries[i].data, entries[i].data);
+      TEST_UNSIGNED(mappedEntries[i].frequency, entries[i].frequency);
+   }
+   htIterBegin(mapped, &iter, 0);
+   for (i = 0; (entry = htIterNext(&iter)) != NULL; i++)
+      TEST_BOOLEAN(entry->data == mappedEntries[i].data, 1);
+   TEST_UNSIGNED(i, size);
+   free(entries);
+   free(mappedEntries);
+   metrics = htMetrics(ht);
+   mappedMetrics = htMetrics(mapped);
+   TEST_UNSIGNED(mappedMetrics.numberOfChains, metrics.numberOfChains);
+   TEST_UNSIGNED(mappedMetrics.maxChainLength, metrics.maxChainLength);
+   TEST_UNSIGNED(htTopK(mapped, 5, mappedTop), htTopK(ht, 5, top));
+   for (i = 0; i < 5; i++)
+      TEST_STRING(mappedTop[i].data, top[i].data);
+   TEST_BOOLEAN(htLookUp(mapped, "key811").data == NULL, 1);
+   htDestroy(mapped);
+   other = htCreate(&funcs, sizes, 3, 0.73f);
+   str = malloc(5);
+   strcpy(str, "key0");
+   htAdd(other, str);
+   replaceAndDamage(ht, other, &funcs);
+   htDestroy(other);
+   htDestroy(ht);
+
+   /* Any engine, any flat data */
+   htDefaultOptions(&options);
+   options.engine = HT_ENGINE_SWISS;
+   ht = htCreateEx(&pointFuncs, sizes, 3, 0.73f, &options);
+   made = 0;
+   for (i = 0; i < 500; i++)
+   {
+      probe.x = (int)(i % 37);
+      probe.y = (int)(i % 11);
+      htFindOrInsert(ht, &probe, makePoint, &made);
+   }
+   mapped = saveAndMap(ht, &pointFuncs, serializePoint);
+   probe.x = 36;
+   probe.y = 3;
+   TEST_UNSIGNED(htLookUp(mapped, &probe).frequency, 2);
+   htDestroy(mapped);
+   htDestroy(ht);
+
+   /* Anything but a complete snapshot is refused */
+   TEST_BOOLEAN(htLoadMapped("feature38.missing", &funcs) == NULL, 1);
+   TEST_SIGNED(htSave(ht = htCreate(&funcs, sizes, 3, 0.73f),
+      "no/such/dir/feature38.img", serializeString), -1);
+   htDestroy(ht);
+   file = fopen("feature38.img", "wb");
+   fputs("semiHT\r\n but truncated", file);
+   fclose(file);
+   TEST_BOOLEAN(htLoadMapped("feature38.img", &funcs) == NULL, 1);
+   remove("feature38.img");
+}
+
+static size_t stringSize(const void *data)
+{
+   return strlen(data) + 1;
+}
+
+/* The usage must add up, and dataBytes or keyBytes must match what the
+ * entries hold: all of their strings, or only those longer than spill.
+ */
+static HTMemoryUsage checkUsage(void *ht, size_t spill)
+{
+   HTMemoryUsage usage = htMemoryUsage(ht);
+   HTMetricsEx metrics;
+   HTEntry *entries;
+   unsigned i, size;
+   size_t bytes = 0;
+
+   entries = htToArray(ht, &size);
+   for (i = 0; i < size; i++)
+      if (stringSize(entries[i].data) > spill)
+         bytes += stringSize(entries[i].data);
+   free(entries);
+   TEST_UNSIGNED(spill ? usage.keyBytes : usage.dataBytes, bytes);
+   TEST_UNSIGNED(usage.entryBytes, size * sizeof(HTEntry));
+   TEST_BOOLEAN(usage.bucketBytes + usage.nodeBytes >= usage.entryBytes, 1);
+   TEST_UNSIGNED(usage.totalBytes, usage.tableBytes + usage.bucketBytes +
+      usage.nodeBytes + usage.keyBytes + usage.dataBytes + usage.slackBytes);
+   htMetricsEx(ht, &metrics);
+   free(metrics.histogram);
+   TEST_UNSIGNED(metrics.memory.totalBytes, htMemoryUsage(ht).totalBytes);
+   return usage;
+}
+
+static void *sizedTable(HTEngineType engine, unsigned incremental)
+{
+   unsigned sizes[] = {7, 31, 131, 521, 2053};
+   HTFunctions funcs = {hashString, compareString, NULL};
+   HTOptions options;
+
+   htDefaultOptions(&options);
+   options.engine = engine;
+   options.incrementalRehash = incremental;
+   options.dataSize = stringSize;
+   return htCreateEx(&funcs, sizes, 5, 0.73f, &options);
+}
+
+static void addKeys(void *ht, unsigned count, unsigned step)
+{
+   unsigned i;
+   char buf[32], *copy;
+
+   for (i = 0; i < count; i++)
+   {
+      keyName(buf, i * step);
+      copy = malloc(strlen(buf) + 1);
+      strcpy(copy, buf);
+      if (htAdd(ht, copy) > 1)
+         free(copy);
+   }
+}
+
+static void feat39()
+{
+   HTEngineType engines[] = {HT_ENGINE_CHAIN, HT_ENGINE_ROBIN_HOOD,
+      HT_ENGINE_SWISS, HT_ENGINE_CONCURRENT};
+   void *ht, *tables[3];
+   HTMemoryUsage usage, before;
+   HTFunctions funcs = {hashString, compareString, NULL};
+   char buf[32];
+   unsigned e;
+
+   /* An empty chain table is only its structures and buckets */
+   ht = sizedTable(HT_ENGINE_CHAIN, 0);
+   usage = checkUsage(ht, 0);
+   TEST_UNSIGNED(usage.bucketBytes, 7 * sizeof(void*));
+   TEST_UNSIGNED(usage.nodeBytes, 0);
+   TEST_UNSIGNED(usage.keyBytes, 0);
+   TEST_BOOLEAN(usage.tableBytes > 0 && usage.slackBytes > 0, 1);
+   htDestroy(ht);
+
+   for (e = 0; e < 4; e++)
+   {
+      ht = sizedTable(engines[e], 0);
+      before = checkUsage(ht, 0);
+      addKeys(ht, 1500, 1);
+      usage = checkUsage(ht, 0);
+      TEST_BOOLEAN(usage.dataBytes > 0, 1);
+      TEST_BOOLEAN(usage.bucketBytes >= htCapacity(ht) * sizeof(void*), 1);
+      TEST_BOOLEAN(usage.totalBytes > before.totalBytes + usage.dataBytes,
+         1);
+      if (engines[e] != HT_ENGINE_CONCURRENT)
+      {
+         keyName(buf, 704);
+         usage.dataBytes -= stringSize(buf);
+         free(htRemove(ht, buf));
+         keyName(buf, 5);
+         while (htDecrement(ht, buf) > 0)
+            ;
+         TEST_UNSIGNED(checkUsage(ht, 0).dataBytes, usage.dataBytes -
+            stringSize(buf));
+      }
+      htDestroy(ht);
+   }
+
+   /* Both bucket arrays count while an incremental rehash runs */
+   ht = sizedTable(HT_ENGINE_CHAIN, 1);
+   addKeys(ht, 7, 1);
+   usage = checkUsage(ht, 0);
+   TEST_UNSIGNED(usage.bucketBytes, (7 + 31) * sizeof(void*));
+   htDestroy(ht);
+
+   /* Merges carry the counts over and drop the data of folded entries */
+   ht = sizedTable(HT_ENGINE_CHAIN, 0);
+   tables[1] = sizedTable(HT_ENGINE_CHAIN, 0);
+   addKeys(ht, 800, 1);
+   addKeys(tables[1], 800, 3);
+   htMerge(ht, tables[1]);
+   checkUsage(ht, 0);
+   tables[0] = ht;
+   tables[1] = sizedTable(HT_ENGINE_CHAIN, 0);
+   tables[2] = sizedTable(HT_ENGINE_CHAIN, 0);
+   addKeys(tables[1], 900, 5);
+   addKeys(tables[2], 900, 7);
+   htMergeAll(tables, 3, 2);
+   checkUsage(ht, 0);
+   htDestroy(ht);
+
+   /* Inline keys: only those too long for their node are keyBytes */
+   ht = inlineTable(13, 0);
+   tables[1] = inlineTable(13, 0);
+   for (e = 0; e < 1000; e++)
+   {
+      keyName(buf, e);
+      htAdd(ht, buf);
+      keyName(buf, e * 3);
+      htAdd(tables[1], buf);
+   }
+   checkUsage(ht, 16);
+   keyName(buf, 704);
+   htRemove(ht, buf);
+   checkUsage(ht, 16);
+   htMerge(ht, tables[1]);
+   TEST_UNSIGNED(checkUsage(ht, 16).dataBytes, 0);
+   htDestroy(ht);
+
+   /* The arena counts as keys, never as data */
+   ht = sizedTable(HT_ENGINE_SWISS, 0);
+   addWords(ht, "the cat saw the dog");
+   usage = htMemoryUsage(ht);
+   TEST_BOOLEAN(usage.keyBytes >= 4096, 1);
+   TEST_UNSIGNED(usage.dataBytes, 0);
+   htDestroy(ht);
+
+   /* A mapped snapshot reports its image */
+   ht = sizedTable(HT_ENGINE_CHAIN, 0);
+   addKeys(ht, 300, 1);
+   tables[0] = saveAndMap(ht, &funcs, serializeString);
+   usage = htMemoryUsage(tables[0]);
+   TEST_BOOLEAN(usage.keyBytes >= htMemoryUsage(ht).dataBytes, 1);
+   TEST_BOOLEAN(usage.nodeBytes >= htUniqueEntries(ht) * sizeof(HTEntry),
+      1);
+   htDestroy(tables[0]);
+   htDestroy(ht);
+}
+
 static void performance()
 {
    int i;
@@ -1286,6 +3207,32 @@ Test* initRegularTests()
       {feat11, "feature11"},
       {feat12, "feature12"},
       {feat13, "feature13"},
+      {feat14, "feature14"},
+      {feat15, "feature15"},
+      {feat16, "feature16"},
+      {feat17, "feature17"},
+      {feat18, "feature18"},
+      {feat19, "feature19"},
+      {feat20, "feature20"},
+      {feat21, "feature21"},
+      {feat22, "feature22"},
+      {feat23, "feature23"},
+      {feat24, "feature24"},
+      {feat25, "feature25"},
+      {feat26, "feature26"},
+      {feat27, "feature27"},
+      {feat28, "feature28"},
+      {feat29, "feature29"},
+      {feat30, "feature30"},
+      {feat31, "feature31"},
+      {feat32, "feature32"},
+      {feat33, "feature33"},
+      {feat34, "feature34"},
+      {feat35, "feature35"},
+      {feat36, "feature36"},
+      {feat37, "feature37"},
+      {feat38, "feature38"},
+      {feat39, "feature39"},
       {performance, "performance"},
       {NULL, NULL}
    };
@@ -0,0 +1,188 @@
+/* Tests for semiHashTable.hpp. The template must behave exactly like a C
+ * table from htCreate given the same hash, sizes and load factor, down to
+ * the order of htToArray and the metrics.
+ *
+ *    gcc -c -Wall -ansi -pedantic hashTable*.c htHashes.c
+ *    g++ -std=c++17 -Wall -pedantic -o testSemiHashTable \
+ *       testSemiHashTable.cpp hashTable*.o htHashes.o -pthread -lm
+ */
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <type_traits>
+#include "semiHashTable.hpp"
+#include "unitTest.h"
+extern "C" {
+#include "hashTable.h"
+#include "htHashes.h"
+}
+
+namespace {
+
+struct StringHash
+{
+   std::size_t operator()(const std::string &s) const
+   {
+      return htHashString(s.c_str());
+   }
+};
+
+int compareString(const void *a, const void *b)
+{
+   return std::strcmp(static_cast<const char*>(a),
+      static_cast<const char*>(b));
+}
+
+char* copyString(const std::string &s)
+{
+   char *copy = static_cast<char*>(std::malloc(s.size() + 1));
+
+   std::strcpy(copy, s.c_str());
+   return copy;
+}
+
+/* Counts live keys and how they were made. */
+struct Counted
+{
+   static int live, copies, moves;
+   int value;
+
+   explicit Counted(int v) : value(v) { live++; }
+   Counted(const Counted &other) : value(other.value) { live++; copies++; }
+   Counted(Counted &&other) : value(other.value) { live++; moves++; }
+   ~Counted() { live--; }
+   bool operator==(const Counted &other) const
+   {
+      return value == other.value;
+   }
+};
+
+int Counted::live, Counted::copies, Counted::moves;
+
+struct CountedHash
+{
+   std::size_t operator()(const Counted &c) const
+   {
+      return htMix32((unsigned)c.value);
+   }
+};
+
+/* A key that can be neither copied nor moved, only emplaced. */
+struct Pinned
+{
+   int a, b;
+
+   Pinned(int x, int y) : a(x), b(y) {}
+   Pinned(const Pinned&) = delete;
+   bool operator==(const Pinned &other) const
+   {
+      return a == other.a && b == other.b;
+   }
+};
+
+struct PinnedHash
+{
+   std::size_t operator()(const Pinned &p) const
+   {
+      return htMix32((unsigned)(p.a * 31 + p.b));
+   }
+};
+
+/* Same sizes, load factor, hash and adds as a C table: every capacity,
+ * frequency, entry order and metric must match.
+ */
+void testMatchesC()
+{
+   unsigned sizes[] = {7, 31, 131, 521};
+   HTFunctions funcs = {htHashString, compareString, NULL};
+   void *ht = htCreate(&funcs, sizes, 4, 0.73f);
+   semi::HashTable<std::string, StringHash> table({7, 31, 131, 521}, 0.73f);
+   std::string key;
+   char *copy;
+   unsigned i, size;
+
+   for (i = 0; i < 1000; i++)
+   {
+      key = "k" + std::to_string(i * 7 % 301);
+      copy = copyString(key);
+      TEST_UNSIGNED(table.add(key), htAdd(ht, copy));
+      if (table.frequency(key) > 1)
+         std::free(copy);
+      TEST_UNSIGNED(table.capacity(), htCapacity(ht));
+   }
+   TEST_UNSIGNED(table.uniqueEntries(), htUniqueEntries(ht));
+   TEST_UNSIGNED(table.totalEntries(), htTotalEntries(ht));
+
+   HTEntry *entries = htToArray(ht, &size);
+   auto array = table.toArray();
+   TEST_UNSIGNED(array.size(), size);
+   for (i = 0; i < size; i++)
+   {
+      TEST_BOOLEAN(array[i]->key == static_cast<char*>(entries[i].data), 1);
+      TEST_UNSIGNED(array[i]->frequency, entries[i].frequency);
+   }
+   std::free(entries);
+
+   HTMetrics cMetrics = htMetrics(ht);
+   semi::Metrics metrics = table.metrics();
+   TEST_UNSIGNED(metrics.numberOfChains, cMetrics.numberOfChains);
+   TEST_UNSIGNED(metrics.maxChainLength, cMetrics.maxChainLength);
+   TEST_REAL(metrics.avgChainLength, cMetrics.avgChainLength, 1e-6);
+   TEST_BOOLEAN(table.lookUp("missing") == nullptr, 1);
+   htDestroy(ht);
+}
+
+void testOwnership()
+{
+   {
+      semi::HashTable<Counted, CountedHash> table({5, 11}, 0.5f);
+      Counted key(1);
+
+      TEST_UNSIGNED(table.add(key), 1);
+      TEST_UNSIGNED(Counted::copies, 1);
+      TEST_UNSIGNED(table.add(Counted(2)), 1);
+      TEST_UNSIGNED(Counted::moves, 1);
+
+      /* A hit neither copies nor moves, emplace only constructs */
+      TEST_UNSIGNED(table.add(key), 2);
+      TEST_UNSIGNED(table.emplace(2), 2);
+      TEST_UNSIGNED(table.emplace(3), 1);
+      TEST_UNSIGNED(Counted::copies, 1);
+      TEST_UNSIGNED(Counted::moves, 1);
+      TEST_SIGNED(Counted::live, 4);
+
+      /* 3 of 5 exceeds 0.5, so the next add grows the table first */
+      TEST_UNSIGNED(table.capacity(), 5);
+      TEST_UNSIGNED(table.add(key), 3);
+      TEST_UNSIGNED(table.capacity(), 11);
+
+      semi::HashTable<Counted, CountedHash> moved(std::move(table));
+      TEST_UNSIGNED(moved.frequency(Counted(2)), 2);
+      semi::HashTable<Counted, CountedHash> other({3}, 1);
+      other.emplace(9);
+      other = std::move(moved);
+      TEST_UNSIGNED(other.uniqueEntries(), 3);
+      TEST_SIGNED(Counted::live, 5);
+   }
+   TEST_SIGNED(Counted::live, 0);
+
+   semi::HashTable<Pinned, PinnedHash> pinned({13}, 1);
+   TEST_UNSIGNED(pinned.emplace(1, 2), 1);
+   TEST_UNSIGNED(pinned.emplace(1, 2), 2);
+   TEST_UNSIGNED(pinned.emplace(2, 1), 1);
+   TEST_UNSIGNED(pinned.totalEntries(), 3);
+
+   static_assert(!std::is_copy_constructible<
+      semi::HashTable<std::string, StringHash>>::value, "move-only");
+   static_assert(std::is_nothrow_move_constructible<
+      semi::HashTable<std::string, StringHash>>::value, "noexcept move");
+}
+
+} /* namespace */
+
+int main()
+{
+   testMatchesC();
+   testOwnership();
+   return 0;
+}
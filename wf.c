@@ -0,0 +1,429 @@
+/* Word frequencies: counts the words of the input files (standard input
+ * when there are none) with a thread per CPU and prints the most frequent
+ * ones, then the throughput on standard error.
+ *
+ *    gcc -O2 -ansi -pedantic -Wall -pthread -o wf wf.c hashTable*.c \
+ *       htHashes.c -lm
+ *    ./wf [-n count] [-t threads] [-i] [file ...]
+ *
+ *    -n: How many words to print, 10 by default.
+ *    -t: The number of worker threads, the number of CPUs by default.
+ *    -i: Ignore case, counting "The" as "the".
+ *
+ * A word is a maximal run of ASCII letters and digits and bytes from 0x80
+ * up, so UTF-8 words stay whole. Files are mapped (read when they cannot
+ * be) and cut into chunks ending at a newline. The workers take chunks in
+ * turn, find the words 16 bytes at a time with SSE2 where available and
+ * count them in a table of their own with htFindOrInsert: the probe is an
+ * HTBytes pointing into the input, and only a word new to the table gets
+ * an HTBytes of its own, still pointing into the input. No word is ever
+ * copied. -i lowers the case in place, in a private copy of the pages.
+ * Finally htMergeAll combines the tables and htTopK picks the words.
+ */
+#define _POSIX_C_SOURCE 200112L
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "hashTableEx.h"
+#include "htHashes.h"
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define CHUNK_BYTES (1UL << 20)
+#define READ_BYTES (1UL << 16)
+#define DEFAULT_COUNT 10
+#define MAX_THREADS 256
+
+typedef struct
+{
+   char *bytes;
+   size_t size;
+   int mapped;
+} Input;
+
+typedef struct
+{
+   char *start, *end;
+} Chunk;
+
+typedef struct
+{
+   Chunk *chunks;
+   unsigned numChunks, next;
+   int fold;
+} Job;
+
+typedef struct
+{
+   Job *job;
+   void *table;
+} Worker;
+
+static unsigned char wordByte[256];
+
+static void usage()
+{
+   fprintf(stderr, "Usage: wf [-n count] [-t threads] [-i] [file ...]\n");
+   exit(EXIT_FAILURE);
+}
+
+static void fail(const char *what)
+{
+   perror(what);
+   exit(EXIT_FAILURE);
+}
+
+static void* allocOrFail(size_t size)
+{
+   void *p = malloc(size);
+
+   if (p == NULL)
+      fail("malloc");
+   return p;
+}
+
+static double now()
+{
+   struct timespec t;
+
+   clock_gettime(CLOCK_MONOTONIC, &t);
+   return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+static void initWordBytes()
+{
+   unsigned c;
+
+   for (c = 0; c < 256; c++)
+      wordByte[c] = (c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') ||
+         (c >= 'A' && c <= 'Z') || c >= 0x80;
+}
+
+static unsigned lowestBit(unsigned mask)
+{
+#ifdef __GNUC__
+   return (unsigned)__builtin_ctz(mask);
+#else
+   unsigned i = 0;
+
+   while (!(mask & 1))
+   {
+      mask >>= 1;
+      i++;
+   }
+   return i;
+#endif
+}
+
+static void* makeWord(const void *probe, void *context)
+{
+   HTBytes *word = allocOrFail(sizeof(HTBytes));
+
+   (void)context;
+   *word = *(const HTBytes*)probe;
+   return word;
+}
+
+static void countWord(void *table, const char *start, const char *end)
+{
+   HTBytes word;
+
+   word.ptr = start;
+   word.len = (size_t)(end - start);
+   htFindOrInsert(table, &word, makeWord, NULL);
+}
+
+#ifdef __SSE2__
+/* One bit per byte of the 16 at p that belongs to a word. With fold the
+ * upper case letters are lowered in place first.
+ */
+static unsigned wordMask(char *p, int fold)
+{
+   __m128i c = _mm_loadu_si128((const __m128i*)p);
+   __m128i l = _mm_or_si128(c, _mm_set1_epi8(0x20));
+   __m128i letter = _mm_and_si128(_mm_cmpgt_epi8(l, _mm_set1_epi8('a' - 1)),
+      _mm_cmplt_epi8(l, _mm_set1_epi8('z' + 1)));
+   __m128i digit = _mm_and_si128(_mm_cmpgt_epi8(c, _mm_set1_epi8('0' - 1)),
+      _mm_cmplt_epi8(c, _mm_set1_epi8('9' + 1)));
+   __m128i high = _mm_cmplt_epi8(c, _mm_setzero_si128());
+
+   if (fold)
+      _mm_storeu_si128((__m128i*)p, _mm_or_si128(c,
+         _mm_and_si128(letter, _mm_set1_epi8(0x20))));
+   return (unsigned)_mm_movemask_epi8(_mm_or_si128(_mm_or_si128(letter,
+      digit), high));
+}
+#else
+static unsigned wordMask(char *p, int fold)
+{
+   unsigned i, mask = 0;
+
+   for (i = 0; i < 16; i++)
+   {
+      if (fold && p[i] >= 'A' && p[i] <= 'Z')
+         p[i] += 'a' - 'A';
+      mask |= (unsigned)wordByte[(unsigned char)p[i]] << i;
+   }
+   return mask;
+}
+#endif
+
+/* Walks the word boundaries of one 16 byte block. *start is the start of
+ * the word still open from the previous block, NULL if there is none.
+ */
+static void scanBlock(void *table, char *p, unsigned mask, char **start)
+{
+   unsigned done = 0, rest;
+
+   while (done < 16)
+   {
+      rest = (*start ? ~mask : mask) & (0xFFFFu << done) & 0xFFFFu;
+      if (rest == 0)
+         return;
+      done = lowestBit(rest);
+      if (*start)
+      {
+         countWord(table, *start, p + done);
+         *start = NULL;
+      }
+      else
+         *start = p + done;
+   }
+}
+
+static void scanTail(void *table, char *p, char *end, char **start, int fold)
+{
+   for (; p < end; p++)
+   {
+      if (fold && *p >= 'A' && *p <= 'Z')
+         *p += 'a' - 'A';
+      if (wordByte[(unsigned char)*p] && *start == NULL)
+         *start = p;
+      else if (!wordByte[(unsigned char)*p] && *start != NULL)
+      {
+         countWord(table, *start, p);
+         *start = NULL;
+      }
+   }
+}
+
+static void scanChunk(void *table, Chunk *chunk, int fold)
+{
+   char *p = chunk->start, *start = NULL;
+
+   for (; chunk->end - p >= 16; p += 16)
+      scanBlock(table, p, wordMask(p, fold), &start);
+   scanTail(table, p, chunk->end, &start, fold);
+   if (start != NULL)
+      countWord(table, start, chunk->end);
+}
+
+static void* work(void *arg)
+{
+   Worker *worker = arg;
+   Job *job = worker->job;
+   unsigned i;
+
+   while ((i = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED)) <
+      job->numChunks)
+      scanChunk(worker->table, &job->chunks[i], job->fold);
+   return NULL;
+}
+
+/* Pipes, terminals and the like cannot be mapped. */
+static void readInput(Input *input, int fd)
+{
+   size_t capacity = READ_BYTES;
+   ssize_t got;
+
+   input->bytes = allocOrFail(capacity);
+   input->size = 0;
+   input->mapped = 0;
+   while ((got = read(fd, input->bytes + input->size,
+      capacity - input->size)) > 0)
+   {
+      input->size += (size_t)got;
+      if (input->size == capacity &&
+         (input->bytes = realloc(input->bytes, capacity *= 2)) == NULL)
+         fail("realloc");
+   }
+   if (got < 0)
+      fail("read");
+}
+
+static void openInput(Input *input, const char *path, int fold)
+{
+   int fd = path ? open(path, O_RDONLY) : STDIN_FILENO;
+   struct stat st;
+   void *bytes;
+
+   if (fd < 0)
+      fail(path);
+   if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0 &&
+      (bytes = mmap(NULL, (size_t)st.st_size, PROT_READ |
+      (fold ? PROT_WRITE : 0), MAP_PRIVATE, fd, 0)) != MAP_FAILED)
+   {
+      input->bytes = bytes;
+      input->size = (size_t)st.st_size;
+      input->mapped = 1;
+   }
+   else
+      readInput(input, fd);
+   if (path)
+      close(fd);
+}
+
+static void closeInput(Input *input)
+{
+   if (input->mapped)
+      munmap(input->bytes, input->size);
+   else
+      free(input->bytes);
+}
+
+/* Cuts every input into chunks of about CHUNK_BYTES ending after a newline
+ * (or at the end of the input), so no word is split between workers.
+ */
+static Chunk* cutChunks(Input *inputs, int numInputs, unsigned *numChunks)
+{
+   unsigned capacity = 0, n = 0;
+   Chunk *chunks;
+   char *p, *end, *nl;
+   int i;
+
+   for (i = 0; i < numInputs; i++)
+      capacity += (unsigned)(inputs[i].size / CHUNK_BYTES) + 1;
+   chunks = allocOrFail(capacity * sizeof(Chunk));
+   for (i = 0; i < numInputs; i++)
+   {
+      end = inputs[i].bytes + inputs[i].size;
+      for (p = inputs[i].bytes; p < end; p = chunks[n++].end)
+      {
+         chunks[n].start = p;
+         chunks[n].end = end;
+         if ((size_t)(end - p) > CHUNK_BYTES && (nl = memchr(p +
+            CHUNK_BYTES - 1, '\n', (size_t)(end - p) - CHUNK_BYTES + 1)))
+            chunks[n].end = nl + 1;
+      }
+   }
+   *numChunks = n;
+   return chunks;
+}
+
+static void* createTable()
+{
+   static unsigned sizes[] = {4093, 65521, 1048573, 16777213, 268435399};
+   HTFunctions funcs = {htHashBytes, htCompareBytes, NULL};
+   HTOptions options;
+
+   htDefaultOptions(&options);
+   options.indexMode = HT_INDEX_RECIPROCAL;
+   return htCreateEx(&funcs, sizes, 5, 0.73f, &options);
+}
+
+/* Runs numThreads workers, the calling thread being the first. */
+static void* countWords(Job *job, unsigned numThreads)
+{
+   Worker workers[MAX_THREADS];
+   pthread_t threads[MAX_THREADS];
+   void *tables[MAX_THREADS];
+   unsigned t;
+
+   for (t = 0; t < numThreads; t++)
+   {
+      workers[t].job = job;
+      workers[t].table = tables[t] = createTable();
+      if (t > 0 && pthread_create(&threads[t], NULL, work, &workers[t]))
+         fail("pthread_create");
+   }
+   work(&workers[0]);
+   for (t = 1; t < numThreads; t++)
+      pthread_join(threads[t], NULL);
+   htMergeAll(tables, numThreads, numThreads);
+   return tables[0];
+}
+
+static void printTop(void *table, unsigned count)
+{
+   HTEntry *top = allocOrFail((count ? count : 1) * sizeof(HTEntry));
+   const HTBytes *word;
+   unsigned i, n = htTopK(table, count, top);
+
+   for (i = 0; i < n; i++)
+   {
+      word = top[i].data;
+      printf("%10u %.*s\n", top[i].frequency, (int)word->len,
+         (const char*)word->ptr);
+   }
+   free(top);
+}
+
+static void parseArgs(int argc, char *argv[], unsigned *count,
+   unsigned *numThreads, int *fold, int *first)
+{
+   long online = sysconf(_SC_NPROCESSORS_ONLN);
+   int i;
+
+   *count = DEFAULT_COUNT;
+   *numThreads = online > 0 ? (unsigned)online : 1;
+   *fold = 0;
+   for (i = 1; i < argc && argv[i][0] == '-' && argv[i][1]; i++)
+   {
+      if (strcmp(argv[i], "-i") == 0)
+         *fold = 1;
+      else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc)
+         *count = (unsigned)strtoul(argv[++i], NULL, 10);
+      else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc)
+         *numThreads = (unsigned)strtoul(argv[++i], NULL, 10);
+      else
+         usage();
+   }
+   if (*numThreads < 1 || *numThreads > MAX_THREADS)
+      usage();
+   *first = i;
+}
+
+int main(int argc, char *argv[])
+{
+   unsigned count, numThreads;
+   int fold, first, numInputs, i;
+   double start = now(), seconds;
+   size_t bytes = 0;
+   Input *inputs;
+   Job job;
+   void *table;
+
+   parseArgs(argc, argv, &count, &numThreads, &fold, &first);
+   initWordBytes();
+   numInputs = first < argc ? argc - first : 1;
+   inputs = allocOrFail(numInputs * sizeof(Input));
+   for (i = 0; i < numInputs; i++)
+   {
+      openInput(&inputs[i], first < argc ? argv[first + i] : NULL, fold);
+      bytes += inputs[i].size;
+   }
+
+   job.chunks = cutChunks(inputs, numInputs, &job.numChunks);
+   job.next = 0;
+   job.fold = fold;
+   table = countWords(&job, numThreads);
+   printTop(table, count);
+   seconds = now() - start;
+   fprintf(stderr, "%lu bytes, %u words, %u unique, %u threads: %.3f s, "
+      "%.2f GB/s\n", (unsigned long)bytes, htTotalEntries(table),
+      htUniqueEntries(table), numThreads, seconds, bytes / seconds / 1e9);
+
+   htDestroy(table);
+   for (i = 0; i < numInputs; i++)
+      closeInput(&inputs[i]);
+   free(inputs);
+   free(job.chunks);
+   return 0;
+}